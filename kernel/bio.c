@@ -7,11 +7,16 @@
 //
 // Interface:
 // * To get a buffer for a particular disk block, call bread.
-// * After changing buffer data, call bwrite to write it to disk.
+// * To get a zeroed buffer for a block whose old contents
+//     don't matter, without reading it, call bnew.
+// * After changing buffer data, call bwrite to write it to disk,
+//     or bwritev to write several buffers at once.
 // * When done with the buffer, call brelse.
 // * Do not use the buffer after calling brelse.
 // * Only one process at a time can use a buffer,
 //     so do not keep them longer than necessary.
+// * To start reading a block that will be needed soon
+//     without waiting for it, call breadahead.
 
 
 #include "types.h"
@@ -33,6 +38,8 @@ struct {
   struct buf head;
 } bcache;
 
+static void bput(struct buf *b);
+
 void
 binit(void)
 {
@@ -62,30 +69,35 @@ bget(uint dev, uint blockno)
 
   acquire(&bcache.lock);
 
-  // Is the block already cached?
-  for(b = bcache.head.next; b != &bcache.head; b = b->next){
-    if(b->dev == dev && b->blockno == blockno){
-      b->refcnt++;
-      release(&bcache.lock);
-      acquiresleep(&b->lock);
-      return b;
+  for(;;){
+    // Is the block already cached?
+    for(b = bcache.head.next; b != &bcache.head; b = b->next){
+      if(b->dev == dev && b->blockno == blockno){
+        b->refcnt++;
+        release(&bcache.lock);
+        acquiresleep(&b->lock);
+        return b;
+      }
     }
-  }
 
-  // Not cached.
-  // Recycle the least recently used (LRU) unused buffer.
-  for(b = bcache.head.prev; b != &bcache.head; b = b->prev){
-    if(b->refcnt == 0) {
-      b->dev = dev;
-      b->blockno = blockno;
-      b->valid = 0;
-      b->refcnt = 1;
-      release(&bcache.lock);
-      acquiresleep(&b->lock);
-      return b;
+    // Not cached.
+    // Recycle the least recently used (LRU) unused buffer.
+    for(b = bcache.head.prev; b != &bcache.head; b = b->prev){
+      if(b->refcnt == 0) {
+        b->dev = dev;
+        b->blockno = blockno;
+        b->valid = 0;
+        b->refcnt = 1;
+        release(&bcache.lock);
+        acquiresleep(&b->lock);
+        return b;
+      }
     }
+
+    // All buffers are in use, perhaps by read-ahead
+    // that will finish soon. Wait for one to be released.
+    sleep(&bcache, &bcache.lock);
   }
-  panic("bget: no buffers");
 }
 
 // Return a locked buf with the contents of the indicated block.
@@ -96,19 +108,97 @@ bread(uint dev, uint blockno)
 
   b = bget(dev, blockno);
   if(!b->valid) {
-    virtio_disk_rw(b, 0);
+    blk_rw(&b, 1, 0);
     b->valid = 1;
   }
   return b;
 }
 
+// Return a locked buf for block blockno, zeroed, without
+// reading the disk. For a newly allocated block, whose old
+// contents don't matter.
+struct buf*
+bnew(uint dev, uint blockno)
+{
+  struct buf *b;
+
+  b = bget(dev, blockno);
+  memset(b->data, 0, BSIZE);
+  b->valid = 1;
+  return b;
+}
+
+// Start reading block blockno into the cache, unless it is
+// already there, without waiting for the disk. The block
+// layer calls bdone() when the read finishes; a bread() of
+// the block meanwhile waits for the buffer's lock.
+// Read-ahead is only a hint: give up rather than wait if
+// there is no free buffer.
+void
+breadahead(uint dev, uint blockno)
+{
+  struct buf *b;
+
+  acquire(&bcache.lock);
+  for(b = bcache.head.next; b != &bcache.head; b = b->next){
+    if(b->dev == dev && b->blockno == blockno){
+      release(&bcache.lock);
+      return;
+    }
+  }
+  for(b = bcache.head.prev; b != &bcache.head; b = b->prev){
+    if(b->refcnt == 0)
+      break;
+  }
+  if(b == &bcache.head){
+    release(&bcache.lock);
+    return;
+  }
+  b->dev = dev;
+  b->blockno = blockno;
+  b->valid = 0;
+  b->refcnt = 1;
+  release(&bcache.lock);
+
+  // no one else holds an unreferenced buffer's lock.
+  acquiresleep(&b->lock);
+  blk_read_async(b);
+}
+
+// Called by the block layer when a read started by
+// breadahead() has finished. b is locked but may not be
+// held by the current process.
+void
+bdone(struct buf *b)
+{
+  b->valid = 1;
+  releasesleep(&b->lock);
+  bput(b);
+}
+
 // Write b's contents to disk.  Must be locked.
 void
 bwrite(struct buf *b)
 {
   if(!holdingsleep(&b->lock))
     panic("bwrite");
-  virtio_disk_rw(b, 1);
+  blk_rw(&b, 1, BLK_WRITE);
+}
+
+// Write the contents of the n bufs b[] together; the block
+// layer sends runs of consecutive blocks as one disk request.
+// If poll is set, spin for the completion (BLK_POLL) rather
+// than sleep; for writes a caller is waiting on, like a log
+// commit. Must be locked.
+void
+bwritev(struct buf **b, int n, int poll)
+{
+  int i;
+
+  for(i = 0; i < n; i++)
+    if(!holdingsleep(&b[i]->lock))
+      panic("bwritev");
+  blk_rw(b, n, BLK_WRITE | (poll ? BLK_POLL : 0));
 }
 
 // Release a locked buffer.
@@ -120,7 +210,13 @@ brelse(struct buf *b)
     panic("brelse");
 
   releasesleep(&b->lock);
+  bput(b);
+}
 
+// Drop a reference to an unlocked buffer.
+static void
+bput(struct buf *b)
+{
   acquire(&bcache.lock);
   b->refcnt--;
   if (b->refcnt == 0) {
@@ -131,6 +227,7 @@ brelse(struct buf *b)
     b->prev = &bcache.head;
     bcache.head.next->prev = b;
     bcache.head.next = b;
+    wakeup(&bcache);
   }
   
   release(&bcache.lock);
@@ -147,6 +244,8 @@ void
 bunpin(struct buf *b) {
   acquire(&bcache.lock);
   b->refcnt--;
+  if(b->refcnt == 0)
+    wakeup(&bcache);
   release(&bcache.lock);
 }
 
@@ -0,0 +1,333 @@
+// Block I/O request queue.
+//
+// The buffer cache passes its disk reads and writes to the
+// block layer rather than straight to the disk driver.
+// Requests wait in a queue, sorted by block number, while
+// BLKDEPTH requests are already at the disk, or while the
+// process that issued them has plugged the queue with
+// blk_plug() to let a batch collect.
+//
+// The dispatcher serves the queue like an elevator moving
+// in one direction (C-SCAN), except that a read which has
+// waited longer than BLKREADEXPIRE goes first. It merges a
+// run of queued requests for consecutive blocks in the same
+// direction into a single disk request.
+//
+// There is one queue for each virtio disk queue, each with
+// its own lock, so that CPUs doing disk I/O at the same time
+// don't contend. A request goes on the queue of the CPU that
+// issued it, and b->qidx remembers which that was.
+//
+// Interface:
+// * blk_rw() reads or writes locked bufs and waits.
+//     With BLK_POLL (the log commit's write, see bwritev()),
+//     or if blkpoll is set, it first spins
+//     for up to BLKPOLLTIME checking the disk for completions,
+//     which for a short request is quicker than sleeping
+//     until the interrupt.
+// * blk_read_async() starts a read; bdone() is called when
+//     it finishes.
+// * blk_plug()/blk_unplug() bracket a batch of async reads.
+// * blk_done() is called by the disk driver.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "riscv.h"
+#include "defs.h"
+#include "proc.h"
+#include "fs.h"
+#include "buf.h"
+#include "blkstat.h"
+
+#define USEC (CLINT_FREQ / 1000000) // time CSR ticks per microsecond
+
+struct blkq {
+  struct spinlock lock;
+  struct buf *queue;  // waiting bufs, through qnext, by blockno
+  uint headpos;       // block after the last one dispatched
+  struct blkstat st;
+};
+
+struct {
+  struct blkq q[NVQ];
+} blk;
+
+int blkpoll = BLKPOLL;  // poll in every blk_rw()?
+
+void
+blkinit(void)
+{
+  for(int i = 0; i < NVQ; i++)
+    initlock(&blk.q[i].lock, "blk");
+}
+
+// The index of this CPU's queue.
+static int
+myqueue(void)
+{
+  int i;
+
+  push_off();
+  i = cpuid() % virtio_disk_nqueue();
+  pop_off();
+  return i;
+}
+
+// Insert b into queue q. Caller holds q->lock.
+static void
+enqueue(struct blkq *q, struct buf *b)
+{
+  struct buf **pp;
+
+  b->qidx = q - blk.q;
+  for(pp = &q->queue; *pp && (*pp)->blockno < b->blockno; pp = &(*pp)->qnext)
+    ;
+  b->qnext = *pp;
+  *pp = b;
+  if(++q->st.depth > q->st.maxdepth)
+    q->st.maxdepth = q->st.depth;
+}
+
+// Return a pointer to the link to the buf that should go
+// to the disk next. Caller holds q->lock.
+static struct buf**
+pick(struct blkq *q)
+{
+  struct buf **pp, **oldest, **next;
+
+  oldest = next = 0;
+  for(pp = &q->queue; *pp; pp = &(*pp)->qnext){
+    if(!(*pp)->qwrite && (oldest == 0 || (*pp)->qtime < (*oldest)->qtime))
+      oldest = pp;
+    if(next == 0 && (*pp)->blockno >= q->headpos)
+      next = pp;
+  }
+  if(oldest && r_time() - (*oldest)->qtime > BLKREADEXPIRE*USEC){
+    q->st.nexpired++;
+    return oldest;
+  }
+  if(next)
+    return next;
+  return &q->queue;  // wrap around to the lowest block
+}
+
+// Send requests from q to its disk queue while that has room.
+// Caller holds q->lock.
+static void
+dispatch(struct blkq *q)
+{
+  struct buf **pp, *b, *last, *rest;
+  int n, nsent, qi;
+
+  qi = q - blk.q;
+  nsent = 0;
+  while(q->queue && q->st.inflight < BLKDEPTH){
+    pp = pick(q);
+    b = *pp;
+
+    // merge the run of bufs queued for the following blocks.
+    last = b;
+    for(n = 1; n < MAXBIOVEC && (rest = last->qnext) != 0; n++){
+      if(rest->blockno != last->blockno + 1 || rest->dev != b->dev ||
+         rest->qwrite != b->qwrite)
+        break;
+      last = rest;
+    }
+    rest = last->qnext;
+    *pp = rest;
+    last->qnext = 0;
+
+    if(virtio_disk_submit(qi, b, n, b->qwrite) < 0){
+      // out of descriptors; try again when a request finishes.
+      last->qnext = rest;
+      *pp = b;
+      break;
+    }
+    nsent++;
+    q->st.depth -= n;
+    q->st.inflight++;
+    q->st.nreq++;
+    q->st.nmerge += n - 1;
+    q->headpos = last->blockno + 1;
+  }
+
+  // one notification for the whole batch.
+  if(nsent > 0)
+    virtio_disk_kick(qi);
+}
+
+// Move the bufs held back by p's plug to queue q.
+// Caller holds q->lock.
+static void
+unplug(struct blkq *q, struct proc *p)
+{
+  struct buf *b;
+
+  while((b = p->plugq) != 0){
+    p->plugq = b->qnext;
+    enqueue(q, b);
+  }
+}
+
+// Does the disk still own any of the n bufs b[]?
+static int
+busy(struct buf **b, int n)
+{
+  int i;
+
+  for(i = 0; i < n; i++)
+    if(b[i]->disk)
+      return 1;
+  return 0;
+}
+
+// Read or write the n locked bufs b[], and wait
+// until the disk is done with them.
+void
+blk_rw(struct buf **b, int n, int flags)
+{
+  struct blkq *q;
+  uint64 now;
+  int i, qi, write;
+
+  write = (flags & BLK_WRITE) != 0;
+  qi = myqueue();
+  q = &blk.q[qi];
+  acquire(&q->lock);
+  unplug(q, myproc());
+  now = r_time();
+  for(i = 0; i < n; i++){
+    b[i]->qwrite = write;
+    b[i]->qasync = 0;
+    b[i]->qtime = now;
+    b[i]->disk = 1;
+    enqueue(q, b[i]);
+  }
+  q->st.nbuf += n;
+  dispatch(q);
+
+  if((blkpoll || (flags & BLK_POLL)) && busy(b, n)){
+    release(&q->lock);
+    while(busy(b, n) && r_time() - now < BLKPOLLTIME*USEC)
+      virtio_disk_poll(qi);
+    acquire(&q->lock);
+    q->st.npoll++;
+    if(!busy(b, n))
+      q->st.npollwon++;
+  }
+  for(i = 0; i < n; i++){
+    while(b[i]->disk)
+      sleep(b[i], &q->lock);
+  }
+  release(&q->lock);
+}
+
+// Start reading locked buf b without waiting for it.
+// bdone(b) is called when the read has finished.
+void
+blk_read_async(struct buf *b)
+{
+  struct proc *p = myproc();
+  struct blkq *q = &blk.q[myqueue()];
+
+  acquire(&q->lock);
+  b->qwrite = 0;
+  b->qasync = 1;
+  b->qtime = r_time();
+  b->disk = 1;
+  q->st.nbuf++;
+  if(p->plug > 0){
+    b->qnext = p->plugq;
+    p->plugq = b;
+  } else {
+    enqueue(q, b);
+    dispatch(q);
+  }
+  release(&q->lock);
+}
+
+// Hold back this process's async reads until the
+// matching blk_unplug(), so they can be merged.
+// Don't wait for one of them (e.g. bread() its block)
+// while plugged.
+void
+blk_plug(void)
+{
+  myproc()->plug++;
+}
+
+void
+blk_unplug(void)
+{
+  struct proc *p = myproc();
+  struct blkq *q;
+
+  if(--p->plug > 0)
+    return;
+  q = &blk.q[myqueue()];
+  acquire(&q->lock);
+  unplug(q, p);
+  dispatch(q);
+  release(&q->lock);
+}
+
+// Called by the disk driver when the request made of the
+// bufs linked from b through qnext has finished.
+void
+blk_done(struct buf *b)
+{
+  struct blkq *q = &blk.q[(int)b->qidx];
+  struct buf *next;
+  uint64 us;
+  int i;
+
+  acquire(&q->lock);
+  us = (r_time() - b->qtime) / USEC;
+  for(i = 0; i < NBLKHIST-1 && us >= 2; i++)
+    us >>= 1;
+  q->st.lat[i]++;
+  q->st.inflight--;
+
+  for(; b; b = next){
+    next = b->qnext;
+    b->qnext = 0;
+    b->disk = 0;
+    if(b->qasync)
+      bdone(b);
+    else
+      wakeup(b);
+  }
+  dispatch(q);
+  release(&q->lock);
+}
+
+// Copy out the statistics, summed over the queues.
+void
+blk_stat(struct blkstat *st)
+{
+  struct blkq *q;
+  int i, j;
+
+  memset(st, 0, sizeof(*st));
+  for(i = 0; i < NVQ; i++){
+    q = &blk.q[i];
+    acquire(&q->lock);
+    st->nbuf += q->st.nbuf;
+    st->nreq += q->st.nreq;
+    st->nmerge += q->st.nmerge;
+    st->nexpired += q->st.nexpired;
+    st->npoll += q->st.npoll;
+    st->npollwon += q->st.npollwon;
+    st->depth += q->st.depth;
+    st->maxdepth += q->st.maxdepth;
+    st->inflight += q->st.inflight;
+    for(j = 0; j < NBLKHIST; j++)
+      st->lat[j] += q->st.lat[j];
+    release(&q->lock);
+  }
+  st->nqueue = virtio_disk_nqueue();
+  virtio_disk_stat(&st->nkick, &st->nintr);
+}
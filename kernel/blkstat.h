@@ -0,0 +1,20 @@
+// Block I/O statistics, as returned by the blkstat() system call.
+
+#define NBLKHIST 16
+
+struct blkstat {
+  uint64 nbuf;      // blocks read or written
+  uint64 nreq;      // disk requests those blocks went out in
+  uint64 nmerge;    // blocks merged into another block's request
+  uint64 nexpired;  // reads sent ahead of the elevator order
+  uint64 nkick;     // notifications sent to the disk
+  uint64 nintr;     // disk interrupts
+  uint64 npoll;     // waits that polled for completion
+  uint64 npollwon;  // ... and saw it before giving up
+  uint depth;       // blocks waiting in the queue now
+  uint maxdepth;    // most blocks ever waiting, summed over queues
+  uint inflight;    // requests at the disk now
+  uint nqueue;      // disk queues in use
+  uint64 lat[NBLKHIST]; // requests that took 2^i..2^(i+1)-1 us
+                        // (lat[0]: under 2 us)
+};
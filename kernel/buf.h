@@ -7,6 +7,18 @@ struct buf {
   uint refcnt;
   struct buf *prev; // LRU cache list
   struct buf *next;
+  struct buf *qnext; // blk.c queue, or next buf in a disk request
+  uint64 qtime;      // time CSR when queued
+  char qwrite;       // write (vs read) request
+  char qasync;       // no one waits: blk.c calls bdone()
+  char qidx;         // blk.c queue (and virtio queue) it is on
+  uint logseq;       // log.c: 1 + seq of the last transaction it was in
+  char ckpt;         // log.c: pinned until the next checkpoint
   uchar data[BSIZE];
 };
 
+// blk_rw() flags.
+#define BLK_WRITE 0x1  // write (vs read) the bufs
+#define BLK_POLL  0x2  // poll for completion before sleeping
+
+
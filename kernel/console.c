@@ -21,6 +21,8 @@
 #include "riscv.h"
 #include "defs.h"
 #include "proc.h"
+#include "poll.h"
+#include "waitq.h"
 
 #define BACKSPACE 0x100
 #define C(x)  ((x)-'@')  // Control-x
@@ -50,6 +52,8 @@ struct {
   uint r;  // Read index
   uint w;  // Write index
   uint e;  // Edit index
+
+  struct waitq wq;  // poll() waiters
 } cons;
 
 //
@@ -126,6 +130,24 @@ consoleread(int user_dst, uint64 dst, int n)
   return target - n;
 }
 
+//
+// poll() on the console: readable once a whole line
+// (or end-of-file) has arrived.
+//
+int
+consolepoll(struct waiter *w)
+{
+  int ev = POLLOUT;
+
+  acquire(&cons.lock);
+  if(w)
+    waitq_add(&cons.wq, w);
+  if(cons.r != cons.w)
+    ev |= POLLIN;
+  release(&cons.lock);
+  return ev;
+}
+
 //
 // the console input interrupt handler.
 // uartintr() calls this for input character.
@@ -170,6 +192,7 @@ consoleintr(int c)
         // has arrived.
         cons.w = cons.e;
         wakeup(&cons.r);
+        waitq_wake(&cons.wq);
       }
     }
     break;
@@ -182,6 +205,7 @@ void
 consoleinit(void)
 {
   initlock(&cons.lock, "cons");
+  initwaitq(&cons.wq, &cons.lock);
 
   uartinit();
 
@@ -189,4 +213,5 @@ consoleinit(void)
   // to consoleread and consolewrite.
   devsw[CONSOLE].read = consoleread;
   devsw[CONSOLE].write = consolewrite;
+  devsw[CONSOLE].poll = consolepoll;
 }
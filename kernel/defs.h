@@ -1,5 +1,8 @@
 struct buf;
+struct blkstat;
 struct context;
+struct epoll;
+struct epoll_event;
 struct file;
 struct inode;
 struct pipe;
@@ -7,21 +10,46 @@ struct proc;
 struct spinlock;
 struct sleeplock;
 struct stat;
+struct statfs;
 struct superblock;
+struct ushared;
+struct waiter;
+struct waitq;
 
 // bio.c
 void            binit(void);
 struct buf*     bread(uint, uint);
+struct buf*     bnew(uint, uint);
 void            brelse(struct buf*);
 void            bwrite(struct buf*);
+void            bwritev(struct buf**, int, int);
 void            bpin(struct buf*);
 void            bunpin(struct buf*);
+void            breadahead(uint, uint);
+void            bdone(struct buf*);
+
+// blk.c
+void            blkinit(void);
+void            blk_rw(struct buf**, int, int);
+void            blk_read_async(struct buf*);
+void            blk_plug(void);
+void            blk_unplug(void);
+void            blk_done(struct buf*);
+void            blk_stat(struct blkstat*);
 
 // console.c
 void            consoleinit(void);
 void            consoleintr(int);
 void            consputc(int);
 
+// epoll.c
+void            epollinit(void);
+int             epollalloc(struct file**);
+void            epollclose(struct epoll*);
+void            epollforget(struct file*);
+int             epollctl(struct epoll*, int, struct file*, struct epoll_event*);
+int             epollwait(struct epoll*, uint64, int, int);
+
 // exec.c
 int             exec(char*, char**);
 
@@ -33,9 +61,14 @@ void            fileinit(void);
 int             fileread(struct file*, uint64, int n);
 int             filestat(struct file*, uint64 addr);
 int             filewrite(struct file*, uint64, int n);
+int             filereadi(struct file*, int, uint64, int);
+int             filewritei(struct file*, int, uint64, int);
+int             filepoll(struct file*, struct waiter*);
 
 // fs.c
 void            fsinit(int);
+void            fsstat(struct statfs*);
+void            dcache_forget(struct inode*, char*);
 int             dirlink(struct inode*, char*, uint);
 struct inode*   dirlookup(struct inode*, char*, uint*);
 struct inode*   ialloc(uint, short);
@@ -59,6 +92,12 @@ void            ramdiskinit(void);
 void            ramdiskintr(void);
 void            ramdiskrw(struct buf*);
 
+// hrtimer.c
+void            hrtimerinit(void);
+int             hrtimerintr(void);
+uint64          nsnow(void);
+int             nanosleep(uint64);
+
 // kalloc.c
 void*           kalloc(void);
 void            kfree(void *);
@@ -69,12 +108,24 @@ void            initlog(int, struct superblock*);
 void            log_write(struct buf*);
 void            begin_op(void);
 void            end_op(void);
+void            log_sync(void);
 
 // pipe.c
 int             pipealloc(struct file**, struct file**);
 void            pipeclose(struct pipe*, int);
 int             piperead(struct pipe*, uint64, int);
 int             pipewrite(struct pipe*, uint64, int);
+int             pipesize(struct pipe*);
+int             pipesetsize(struct pipe*, int);
+int             pipesplicein(struct pipe*, struct file*, int);
+int             pipespliceout(struct pipe*, struct file*, int);
+int             pipepoll(struct pipe*, struct waiter*);
+
+// poll.c
+void            initwaitq(struct waitq*, struct spinlock*);
+void            waitq_add(struct waitq*, struct waiter*);
+void            waitq_del(struct waiter*);
+void            waitq_wake(struct waitq*);
 
 // printf.c
 void            printf(char*, ...);
@@ -85,6 +136,7 @@ void            printfinit(void);
 int             cpuid(void);
 void            exit(int);
 int             fork(void);
+int             kthread(void (*)(void), char*);
 int             growproc(int);
 void            proc_mapstacks(pagetable_t);
 pagetable_t     proc_pagetable(struct proc *);
@@ -144,6 +196,8 @@ extern uint     ticks;
 void            trapinit(void);
 void            trapinithart(void);
 extern struct spinlock tickslock;
+extern struct waitq tickswq;
+extern struct ushared *ushared;
 void            usertrapret(void);
 
 // uart.c
@@ -179,7 +233,11 @@ void            plic_complete(int);
 
 // virtio_disk.c
 void            virtio_disk_init(void);
-void            virtio_disk_rw(struct buf *, int);
+int             virtio_disk_nqueue(void);
+int             virtio_disk_submit(int, struct buf *, int, int);
+void            virtio_disk_kick(int);
+void            virtio_disk_poll(int);
+void            virtio_disk_stat(uint64*, uint64*);
 void            virtio_disk_intr(void);
 
 // number of elements in fixed-size array
@@ -0,0 +1,315 @@
+// Event notification for many files (epoll).
+//
+// An epoll instance is a file holding a set of watched
+// files. Each watched file has an epitem whose waiter (see
+// poll.c) sits on the object behind the file. When the
+// object calls the waiter, the item goes on the instance's
+// ready list, so epoll_wait() looks only at the files that
+// have changed, not at every watched file.
+//
+// A level-triggered item stays on the ready list for as long
+// as its file has events; an edge-triggered (EPOLLET) one is
+// reported once after each change.
+
+#include "types.h"
+#include "param.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "proc.h"
+#include "fs.h"
+#include "file.h"
+#include "defs.h"
+#include "poll.h"
+#include "epoll.h"
+#include "waitq.h"
+
+struct epoll {
+  struct spinlock lock;   // protects ready and the items' ready flags
+  struct epitem *ready;   // items whose files may have events
+};
+
+struct epitem {
+  struct epoll *ep;       // instance, or 0 if the item is free
+  struct file *f;         // watched file
+  int events;             // events of interest, and EPOLLET
+  uint64 data;
+  struct waiter w;        // on the object behind f
+  int ready;              // on ep->ready, or being looked at by epollwait()
+  struct epitem *next;    // ep->ready list
+};
+
+// The items of all instances. The sleep-lock serializes
+// adding, changing and removing items, and epollwait()'s
+// scans of ready lists.
+struct {
+  struct sleeplock lock;
+  struct epitem item[NEPITEM];
+} eptable;
+
+void
+epollinit(void)
+{
+  initsleeplock(&eptable.lock, "eptable");
+}
+
+// Put it on its instance's ready list.
+// Caller holds it->ep->lock.
+static void
+queue(struct epitem *it)
+{
+  if(!it->ready){
+    it->ready = 1;
+    it->next = it->ep->ready;
+    it->ep->ready = it;
+  }
+}
+
+// Called by the object behind the item's file when its
+// state changes.
+static void
+epollwake(struct waiter *w)
+{
+  struct epitem *it = w->arg;
+  struct epoll *ep = it->ep;
+
+  acquire(&ep->lock);
+  queue(it);
+  wakeup(ep);
+  release(&ep->lock);
+}
+
+// Called on each clock tick while epollwait() has a timeout.
+static void
+epolltick(struct waiter *w)
+{
+  struct epoll *ep = w->arg;
+
+  acquire(&ep->lock);
+  wakeup(ep);
+  release(&ep->lock);
+}
+
+// Queue it if its file has events now. Given a waiter,
+// also start watching the file.
+static void
+itemcheck(struct epitem *it, struct waiter *w)
+{
+  if(filepoll(it->f, w) & (it->events | POLLERR | POLLHUP))
+    epollwake(&it->w);
+}
+
+// Stop watching it->f. Caller holds eptable.lock.
+static void
+itemfree(struct epitem *it)
+{
+  struct epoll *ep = it->ep;
+  struct epitem **pp;
+
+  waitq_del(&it->w);
+  acquire(&ep->lock);
+  if(it->ready){
+    for(pp = &ep->ready; *pp; pp = &(*pp)->next){
+      if(*pp == it){
+        *pp = it->next;
+        break;
+      }
+    }
+    it->ready = 0;
+  }
+  release(&ep->lock);
+  it->f->nepoll--;
+  it->f = 0;
+  it->ep = 0;
+}
+
+int
+epollalloc(struct file **pf)
+{
+  struct file *f;
+  struct epoll *ep;
+
+  if((f = filealloc()) == 0)
+    return -1;
+  if((ep = (struct epoll*)kalloc()) == 0){
+    fileclose(f);
+    return -1;
+  }
+  memset(ep, 0, sizeof(*ep));
+  initlock(&ep->lock, "epoll");
+  f->type = FD_EPOLL;
+  f->readable = 0;
+  f->writable = 0;
+  f->epoll = ep;
+  *pf = f;
+  return 0;
+}
+
+// The last reference to ep's file has gone.
+void
+epollclose(struct epoll *ep)
+{
+  struct epitem *it;
+
+  acquiresleep(&eptable.lock);
+  for(it = eptable.item; it < eptable.item + NEPITEM; it++)
+    if(it->ep == ep)
+      itemfree(it);
+  releasesleep(&eptable.lock);
+  kfree((char*)ep);
+}
+
+// The last reference to f is going away; stop watching
+// it before the file table can reuse it.
+void
+epollforget(struct file *f)
+{
+  struct epitem *it;
+
+  acquiresleep(&eptable.lock);
+  for(it = eptable.item; it < eptable.item + NEPITEM; it++)
+    if(it->ep && it->f == f)
+      itemfree(it);
+  releasesleep(&eptable.lock);
+}
+
+// Add, change or remove (op) ep's watch on f.
+int
+epollctl(struct epoll *ep, int op, struct file *f, struct epoll_event *ev)
+{
+  struct epitem *it, *fit;
+  int r = -1;
+
+  if(f->type == FD_EPOLL)
+    return -1;
+  acquiresleep(&eptable.lock);
+  fit = 0;
+  for(it = eptable.item; it < eptable.item + NEPITEM; it++){
+    if(it->ep == ep && it->f == f){
+      fit = it;
+      break;
+    }
+  }
+  switch(op){
+  case EPOLL_CTL_ADD:
+    if(fit)
+      break;
+    for(it = eptable.item; it < eptable.item + NEPITEM; it++)
+      if(it->ep == 0)
+        break;
+    if(it == eptable.item + NEPITEM)
+      break;
+    it->ep = ep;
+    it->f = f;
+    it->events = ev->events;
+    it->data = ev->data;
+    it->ready = 0;
+    it->w.wq = 0;
+    it->w.fn = epollwake;
+    it->w.arg = it;
+    f->nepoll++;
+    itemcheck(it, &it->w);
+    r = 0;
+    break;
+  case EPOLL_CTL_MOD:
+    if(fit == 0)
+      break;
+    fit->events = ev->events;
+    fit->data = ev->data;
+    itemcheck(fit, 0);
+    r = 0;
+    break;
+  case EPOLL_CTL_DEL:
+    if(fit == 0)
+      break;
+    itemfree(fit);
+    r = 0;
+    break;
+  }
+  releasesleep(&eptable.lock);
+  return r;
+}
+
+// Wait for events on ep's files, or for timeout ticks
+// (forever if timeout < 0), and copy up to max of them to
+// the user array of struct epoll_event at addr. Returns how
+// many, 0 on timeout.
+int
+epollwait(struct epoll *ep, uint64 addr, int max, int timeout)
+{
+  struct proc *p = myproc();
+  struct epitem *it, *list;
+  struct epoll_event ev;
+  struct waiter tw;
+  uint ticks0;
+  int n;
+
+  if(max <= 0)
+    return -1;
+  tw.wq = 0;
+  tw.fn = epolltick;
+  tw.arg = ep;
+  acquire(&tickslock);
+  ticks0 = ticks;
+  if(timeout > 0)
+    waitq_add(&tickswq, &tw);
+  release(&tickslock);
+
+  for(;;){
+    n = 0;
+    acquiresleep(&eptable.lock);
+    acquire(&ep->lock);
+    list = ep->ready;
+    ep->ready = 0;
+    release(&ep->lock);
+
+    // items on list keep ready set, so epollwake() leaves
+    // their next alone until they are taken off.
+    while(list && n < max){
+      acquire(&ep->lock);
+      it = list;
+      list = it->next;
+      it->ready = 0;
+      release(&ep->lock);
+
+      ev.events = filepoll(it->f, 0) & (it->events | POLLERR | POLLHUP);
+      if(ev.events == 0)
+        continue;
+      ev.data = it->data;
+      if(copyout(p->pagetable, addr + n*sizeof(ev), (char*)&ev, sizeof(ev)) < 0){
+        n = -1;
+        break;
+      }
+      n++;
+      if((it->events & EPOLLET) == 0){
+        acquire(&ep->lock);
+        queue(it);
+        release(&ep->lock);
+      }
+    }
+    if(list){
+      // no room for the rest; leave them for the next call.
+      acquire(&ep->lock);
+      for(it = list; it->next; it = it->next)
+        ;
+      it->next = ep->ready;
+      ep->ready = list;
+      release(&ep->lock);
+    }
+    releasesleep(&eptable.lock);
+
+    if(n != 0 || timeout == 0 || p->killed)
+      break;
+    acquire(&ep->lock);
+    while(ep->ready == 0 && !p->killed && (timeout < 0 || ticks - ticks0 < timeout))
+      sleep(ep, &ep->lock);
+    release(&ep->lock);
+    if(timeout > 0 && ticks - ticks0 >= timeout)
+      break;
+  }
+
+  waitq_del(&tw);
+  if(p->killed)
+    return -1;
+  return n;
+}
@@ -0,0 +1,12 @@
+// epoll system call interface.
+
+struct epoll_event {
+  int events;     // POLLIN, POLLOUT, ... (see poll.h), EPOLLET
+  uint64 data;    // returned with the events, for the caller
+};
+
+#define EPOLLET  0x1000  // edge-triggered: report each change once
+
+#define EPOLL_CTL_ADD 1  // watch a file
+#define EPOLL_CTL_DEL 2  // stop watching a file
+#define EPOLL_CTL_MOD 3  // change the events of interest
@@ -12,6 +12,7 @@
 #include "file.h"
 #include "stat.h"
 #include "proc.h"
+#include "poll.h"
 
 struct devsw devsw[NDEV];
 struct {
@@ -64,6 +65,13 @@ fileclose(struct file *f)
   acquire(&ftable.lock);
   if(f->ref < 1)
     panic("fileclose");
+  if(f->ref == 1 && f->nepoll > 0){
+    // the last reference, so no one can add f to another
+    // epoll instance while the lock is released.
+    release(&ftable.lock);
+    epollforget(f);
+    acquire(&ftable.lock);
+  }
   if(--f->ref > 0){
     release(&ftable.lock);
     return;
@@ -79,6 +87,8 @@ fileclose(struct file *f)
     begin_op();
     iput(ff.ip);
     end_op();
+  } else if(ff.type == FD_EPOLL){
+    epollclose(ff.epoll);
   }
 }
 
@@ -101,6 +111,89 @@ filestat(struct file *f, uint64 addr)
   return -1;
 }
 
+// Return the poll() events (POLLIN, POLLOUT, ...) ready on f.
+// If w is not null, also have the object behind f call w->fn
+// when they may have changed, until waitq_del(w).
+int
+filepoll(struct file *f, struct waiter *w)
+{
+  int ev = 0;
+
+  if(f->type == FD_PIPE){
+    ev = pipepoll(f->pipe, w);
+    if(f->readable)
+      ev &= POLLIN | POLLHUP;
+    else
+      ev &= POLLOUT | POLLERR;
+  } else if(f->type == FD_DEVICE){
+    if(f->major < 0 || f->major >= NDEV)
+      return POLLNVAL;
+    if(devsw[f->major].poll)
+      ev = devsw[f->major].poll(w);
+    else
+      ev = POLLIN | POLLOUT;
+  } else if(f->type == FD_INODE){
+    // the file system never makes a read or write wait.
+    ev = POLLIN | POLLOUT;
+  }
+  if(!f->readable)
+    ev &= ~POLLIN;
+  if(!f->writable)
+    ev &= ~POLLOUT;
+  return ev;
+}
+
+// Read from inode file f at its offset. If user_dst==1,
+// addr is a user virtual address; otherwise, a kernel address.
+int
+filereadi(struct file *f, int user_dst, uint64 addr, int n)
+{
+  int r;
+
+  ilock(f->ip);
+  if((r = readi(f->ip, user_dst, addr, f->off, n)) > 0)
+    f->off += r;
+  iunlock(f->ip);
+  return r;
+}
+
+// Write to inode file f at its offset. If user_src==1,
+// addr is a user virtual address; otherwise, a kernel address.
+int
+filewritei(struct file *f, int user_src, uint64 addr, int n)
+{
+  int r;
+
+  // write a few blocks at a time to avoid exceeding
+  // the maximum log transaction size, including
+  // i-node, up to three levels of indirect blocks,
+  // allocation blocks, and 2 blocks of slop for
+  // non-aligned writes.
+  // this really belongs lower down, since writei()
+  // might be writing a device like the console.
+  int max = ((MAXOPBLOCKS-1-3-2) / 2) * BSIZE;
+  int i = 0;
+  while(i < n){
+    int n1 = n - i;
+    if(n1 > max)
+      n1 = max;
+
+    begin_op();
+    ilock(f->ip);
+    if ((r = writei(f->ip, user_src, addr + i, f->off, n1)) > 0)
+      f->off += r;
+    iunlock(f->ip);
+    end_op();
+
+    if(r != n1){
+      // error from writei
+      break;
+    }
+    i += r;
+  }
+  return i == n ? n : -1;
+}
+
 // Read from file f.
 // addr is a user virtual address.
 int
@@ -118,10 +211,7 @@ fileread(struct file *f, uint64 addr, int n)
       return -1;
     r = devsw[f->major].read(1, addr, n);
   } else if(f->type == FD_INODE){
-    ilock(f->ip);
-    if((r = readi(f->ip, 1, addr, f->off, n)) > 0)
-      f->off += r;
-    iunlock(f->ip);
+    r = filereadi(f, 1, addr, n);
   } else {
     panic("fileread");
   }
@@ -134,7 +224,7 @@ fileread(struct file *f, uint64 addr, int n)
 int
 filewrite(struct file *f, uint64 addr, int n)
 {
-  int r, ret = 0;
+  int ret = 0;
 
   if(f->writable == 0)
     return -1;
@@ -146,33 +236,7 @@ filewrite(struct file *f, uint64 addr, int n)
       return -1;
     ret = devsw[f->major].write(1, addr, n);
   } else if(f->type == FD_INODE){
-    // write a few blocks at a time to avoid exceeding
-    // the maximum log transaction size, including
-    // i-node, indirect block, allocation blocks,
-    // and 2 blocks of slop for non-aligned writes.
-    // this really belongs lower down, since writei()
-    // might be writing a device like the console.
-    int max = ((MAXOPBLOCKS-1-1-2) / 2) * BSIZE;
-    int i = 0;
-    while(i < n){
-      int n1 = n - i;
-      if(n1 > max)
-        n1 = max;
-
-      begin_op();
-      ilock(f->ip);
-      if ((r = writei(f->ip, 1, addr + i, f->off, n1)) > 0)
-        f->off += r;
-      iunlock(f->ip);
-      end_op();
-
-      if(r != n1){
-        // error from writei
-        break;
-      }
-      i += r;
-    }
-    ret = (i == n ? n : -1);
+    ret = filewritei(f, 1, addr, n);
   } else {
     panic("filewrite");
   }
@@ -1,5 +1,5 @@
 struct file {
-  enum { FD_NONE, FD_PIPE, FD_INODE, FD_DEVICE } type;
+  enum { FD_NONE, FD_PIPE, FD_INODE, FD_DEVICE, FD_EPOLL } type;
   int ref; // reference count
   char readable;
   char writable;
@@ -7,6 +7,8 @@ struct file {
   struct inode *ip;  // FD_INODE and FD_DEVICE
   uint off;          // FD_INODE
   short major;       // FD_DEVICE
+  struct epoll *epoll; // FD_EPOLL
+  int nepoll;        // epoll instances watching this file
 };
 
 #define major(dev)  ((dev) >> 16 & 0xFFFF)
@@ -18,6 +20,9 @@ struct inode {
   uint dev;           // Device number
   uint inum;          // Inode number
   int ref;            // Reference count
+  struct inode *hnext; // itable hash chain
+  struct inode *prev; // itable free list, if ref is zero
+  struct inode *next;
   struct sleeplock lock; // protects everything below here
   int valid;          // inode has been read from disk?
 
@@ -26,13 +31,30 @@ struct inode {
   short minor;
   short nlink;
   uint size;
-  uint addrs[NDIRECT+1];
+  uint addrs[NDIRECT+3];
+
+  struct {            // blocks lbn..lbn+len-1 are at pbn..pbn+len-1
+    uint lbn;
+    uint pbn;
+    uint len;
+  } ext;
+  struct {            // indirect block addr maps blocks lbn..lbn+NINDIRECT-1
+    uint lbn;
+    uint addr;
+  } leaf;
+  struct {            // sequential read-ahead, see readi()
+    uint off;         // where a sequential read would start
+    uint win;         // blocks to keep read ahead
+    uint end;         // blocks before end have been read ahead
+  } ra;
 };
 
 // map major device number to device functions.
+struct waiter;
 struct devsw {
   int (*read)(int, uint64, int);
   int (*write)(int, uint64, int);
+  int (*poll)(struct waiter*);   // optional; see filepoll()
 };
 
 extern struct devsw devsw[];
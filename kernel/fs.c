@@ -20,12 +20,27 @@
 #include "fs.h"
 #include "buf.h"
 #include "file.h"
+#include "statfs.h"
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
 // there should be one superblock per disk device, but we run with
 // only one device
 struct superblock sb; 
 
+#define NBMAP (FSSIZE/BPB + 1)  // max bitmap blocks
+
+// In-memory summary of the free-block bitmap, built by
+// fsinit(), so that balloc() can pass over full bitmap
+// blocks without reading them.
+struct {
+  struct spinlock lock;
+  uint nfree[NBMAP];  // free blocks under each bitmap block
+  uint total;         // free blocks in all
+  uint cursor;        // where balloc() looks first without a goal
+} bsum;
+
+static void bsuminit(int dev);
+
 // Read the super block.
 static void
 readsb(int dev, struct superblock *sb)
@@ -44,41 +59,97 @@ fsinit(int dev) {
   if(sb.magic != FSMAGIC)
     panic("invalid file system");
   initlog(dev, &sb);
+  bsuminit(dev);
 }
 
-// Zero a block.
+// Blocks.
+
+// Count the free blocks under each bitmap block.
 static void
-bzero(int dev, int bno)
+bsuminit(int dev)
 {
   struct buf *bp;
+  uint b, bi, n;
 
-  bp = bread(dev, bno);
-  memset(bp->data, 0, BSIZE);
-  log_write(bp);
-  brelse(bp);
+  initlock(&bsum.lock, "bsum");
+  if(sb.size > NBMAP*BPB)
+    panic("bsuminit: file system too big");
+  for(b = 0; b < sb.size; b += BPB){
+    bp = bread(dev, BBLOCK(b, sb));
+    n = 0;
+    for(bi = 0; bi < BPB && b + bi < sb.size; bi++){
+      if((bp->data[bi/8] & (1 << (bi % 8))) == 0)
+        n++;
+    }
+    brelse(bp);
+    bsum.nfree[b/BPB] = n;
+    bsum.total += n;
+  }
 }
 
-// Blocks.
+// Find a free block at or after block start in bitmap block
+// bp, which covers the blocks from base. Looks a 32-bit word
+// at a time. Returns 0 if there is none (block 0 is never free).
+static uint
+bfind(struct buf *bp, uint base, uint start)
+{
+  uint *w = (uint*)bp->data;
+  uint bi, x;
+
+  for(bi = start - base; bi < BPB && base + bi < sb.size; bi = (bi | 31) + 1){
+    x = w[bi/32] | ((1U << (bi % 32)) - 1);  // skip bits before bi
+    if(x == 0xffffffff)
+      continue;
+    for(bi &= ~31; x & 1; x >>= 1)
+      bi++;
+    if(base + bi >= sb.size)
+      break;
+    return base + bi;
+  }
+  return 0;
+}
 
-// Allocate a zeroed disk block.
+// Allocate a disk block. Its contents are whatever was on the
+// disk; the caller uses bnew() to start it off zeroed in the
+// cache without reading it. If goal is not zero, prefer
+// goal itself or the next free block after it, so that a file
+// written in order is laid out in contiguous runs. Otherwise
+// start from where the last allocation left off. Bitmap blocks
+// that bsum says are full are not read.
 static uint
-balloc(uint dev)
+balloc(uint dev, uint goal)
 {
-  int b, bi, m;
+  uint start, base, b, bi, nb, i, k, nfree;
   struct buf *bp;
 
-  bp = 0;
-  for(b = 0; b < sb.size; b += BPB){
-    bp = bread(dev, BBLOCK(b, sb));
-    for(bi = 0; bi < BPB && b + bi < sb.size; bi++){
-      m = 1 << (bi % 8);
-      if((bp->data[bi/8] & m) == 0){  // Is block free?
-        bp->data[bi/8] |= m;  // Mark block in use.
-        log_write(bp);
-        brelse(bp);
-        bzero(dev, b + bi);
-        return b + bi;
-      }
+  nb = (sb.size + BPB - 1) / BPB;
+  acquire(&bsum.lock);
+  start = goal > 0 && goal < sb.size ? goal : bsum.cursor;
+  release(&bsum.lock);
+
+  // each bitmap block from start's on, wrapping around,
+  // and finally the part of start's before start.
+  for(k = 0; k <= nb; k++){
+    i = (start/BPB + k) % nb;
+    base = i * BPB;
+    acquire(&bsum.lock);
+    nfree = bsum.nfree[i];
+    release(&bsum.lock);
+    if(nfree == 0)
+      continue;
+    bp = bread(dev, BBLOCK(base, sb));
+    b = bfind(bp, base, k == 0 ? start : base);
+    if(b != 0){
+      bi = b % BPB;
+      bp->data[bi/8] |= 1 << (bi % 8);  // Mark block in use.
+      log_write(bp);
+      brelse(bp);
+      acquire(&bsum.lock);
+      bsum.nfree[i]--;
+      bsum.total--;
+      bsum.cursor = b + 1 < sb.size ? b + 1 : 0;
+      release(&bsum.lock);
+      return b;
     }
     brelse(bp);
   }
@@ -100,6 +171,23 @@ bfree(int dev, uint b)
   bp->data[bi/8] &= ~m;
   log_write(bp);
   brelse(bp);
+  acquire(&bsum.lock);
+  bsum.nfree[b/BPB]++;
+  bsum.total++;
+  release(&bsum.lock);
+}
+
+// Describe the file system, for statfs().
+void
+fsstat(struct statfs *st)
+{
+  st->size = sb.size;
+  st->nblocks = sb.nblocks;
+  st->ninodes = sb.ninodes;
+  st->nlog = sb.nlog;
+  acquire(&bsum.lock);
+  st->nfree = bsum.total;
+  release(&bsum.lock);
 }
 
 // Inodes.
@@ -127,18 +215,25 @@ bfree(int dev, uint b)
 //   is non-zero. ialloc() allocates, and iput() frees if
 //   the reference and link counts have fallen to zero.
 //
-// * Referencing in table: an entry in the inode table
-//   is free if ip->ref is zero. Otherwise ip->ref tracks
-//   the number of in-memory pointers to the entry (open
-//   files and current directories). iget() finds or
-//   creates a table entry and increments its ref; iput()
-//   decrements ref.
+// * Referencing in table: ip->ref tracks the number of
+//   in-memory pointers to the entry (open files and current
+//   directories). iget() finds or creates a table entry and
+//   increments its ref; iput() decrements ref.
+//
+// * Cached: an entry whose ref has fallen to zero is not
+//   forgotten. It stays in the hash table under its (dev,
+//   inum), with its contents still valid, and goes on the
+//   free list, which is kept in least-recently-used order.
+//   iget() revives such an entry without reading the disk;
+//   when it needs an entry for an inode not in the table it
+//   recycles the least recently used free one.
 //
 // * Valid: the information (type, size, &c) in an inode
 //   table entry is only correct when ip->valid is 1.
 //   ilock() reads the inode from
 //   the disk and sets ip->valid, while iput() clears
-//   ip->valid if ip->ref has fallen to zero.
+//   ip->valid when it frees the inode on disk, and iget()
+//   clears it when it recycles the entry for another inode.
 //
 // * Locked: file system code may only examine and modify
 //   the information in an inode and its content if it
@@ -163,28 +258,47 @@ bfree(int dev, uint b)
 // multi-step atomic operations.
 //
 // The itable.lock spin-lock protects the allocation of itable
-// entries. Since ip->ref indicates whether an entry is free,
-// and ip->dev and ip->inum indicate which i-node an entry
-// holds, one must hold itable.lock while using any of those fields.
+// entries, the hash chains and the free list. Since ip->ref
+// indicates whether an entry is free, and ip->dev and ip->inum
+// indicate which i-node an entry holds, one must hold itable.lock
+// while using any of those fields.
 //
 // An ip->lock sleep-lock protects all ip-> fields other than ref,
 // dev, and inum.  One must hold ip->lock in order to
 // read or write that inode's ip->valid, ip->size, ip->type, &c.
 
+#define NIHASH 257
+#define IHASH(dev, inum) (((dev)*31 + (inum)) % NIHASH)
+
 struct {
   struct spinlock lock;
   struct inode inode[NINODE];
+  struct inode *hash[NIHASH];
+
+  // Free list of entries with ref == 0, through prev/next.
+  // head.next is most recently released, head.prev is least.
+  struct inode head;
 } itable;
 
+static void dcacheinit(void);
+static void dcache_purge(uint dev, uint dinum);
+
 void
 iinit()
 {
   int i = 0;
   
   initlock(&itable.lock, "itable");
+  itable.head.prev = &itable.head;
+  itable.head.next = &itable.head;
   for(i = 0; i < NINODE; i++) {
     initsleeplock(&itable.inode[i].lock, "inode");
+    itable.inode[i].next = itable.head.next;
+    itable.inode[i].prev = &itable.head;
+    itable.head.next->prev = &itable.inode[i];
+    itable.head.next = &itable.inode[i];
   }
+  dcacheinit();
 }
 
 static struct inode* iget(uint dev, uint inum);
@@ -242,31 +356,44 @@ iupdate(struct inode *ip)
 static struct inode*
 iget(uint dev, uint inum)
 {
-  struct inode *ip, *empty;
+  struct inode *ip, **pp;
 
   acquire(&itable.lock);
 
   // Is the inode already in the table?
-  empty = 0;
-  for(ip = &itable.inode[0]; ip < &itable.inode[NINODE]; ip++){
-    if(ip->ref > 0 && ip->dev == dev && ip->inum == inum){
-      ip->ref++;
+  for(ip = itable.hash[IHASH(dev, inum)]; ip; ip = ip->hnext){
+    if(ip->dev == dev && ip->inum == inum){
+      if(ip->ref++ == 0){
+        // take it off the free list.
+        ip->next->prev = ip->prev;
+        ip->prev->next = ip->next;
+      }
       release(&itable.lock);
       return ip;
     }
-    if(empty == 0 && ip->ref == 0)    // Remember empty slot.
-      empty = ip;
   }
 
-  // Recycle an inode entry.
-  if(empty == 0)
+  // Recycle the least recently used free entry.
+  ip = itable.head.prev;
+  if(ip == &itable.head)
     panic("iget: no inodes");
+  ip->next->prev = ip->prev;
+  ip->prev->next = ip->next;
+  if(ip->inum != 0){
+    for(pp = &itable.hash[IHASH(ip->dev, ip->inum)]; *pp; pp = &(*pp)->hnext){
+      if(*pp == ip){
+        *pp = ip->hnext;
+        break;
+      }
+    }
+  }
 
-  ip = empty;
   ip->dev = dev;
   ip->inum = inum;
   ip->ref = 1;
   ip->valid = 0;
+  ip->hnext = itable.hash[IHASH(dev, inum)];
+  itable.hash[IHASH(dev, inum)] = ip;
   release(&itable.lock);
 
   return ip;
@@ -306,6 +433,9 @@ ilock(struct inode *ip)
     ip->size = dip->size;
     memmove(ip->addrs, dip->addrs, sizeof(ip->addrs));
     brelse(bp);
+    ip->ext.len = 0;
+    ip->leaf.addr = 0;
+    memset(&ip->ra, 0, sizeof(ip->ra));
     ip->valid = 1;
     if(ip->type == 0)
       panic("ilock: no type");
@@ -323,8 +453,8 @@ iunlock(struct inode *ip)
 }
 
 // Drop a reference to an in-memory inode.
-// If that was the last reference, the inode table entry can
-// be recycled.
+// If that was the last reference, the inode table entry goes
+// on the free list, from which it can be revived or recycled.
 // If that was the last reference and the inode has no links
 // to it, free the inode (and its content) on disk.
 // All calls to iput() must be inside a transaction in
@@ -344,6 +474,8 @@ iput(struct inode *ip)
     release(&itable.lock);
 
     itrunc(ip);
+    if(ip->type == T_DIR)
+      dcache_purge(ip->dev, ip->inum);
     ip->type = 0;
     iupdate(ip);
     ip->valid = 0;
@@ -353,7 +485,19 @@ iput(struct inode *ip)
     acquire(&itable.lock);
   }
 
-  ip->ref--;
+  if(--ip->ref == 0){
+    if(ip->valid){
+      // keep it cached: most recently used end.
+      ip->next = itable.head.next;
+      ip->prev = &itable.head;
+    } else {
+      // nothing worth keeping: recycle it first.
+      ip->next = &itable.head;
+      ip->prev = itable.head.prev;
+    }
+    ip->next->prev = ip;
+    ip->prev->next = ip;
+  }
   release(&itable.lock);
 }
 
@@ -373,35 +517,140 @@ iunlockput(struct inode *ip)
 // listed in block ip->addrs[NDIRECT].
 
 // Return the disk block address of the nth block in inode ip.
-// If there is no such block, bmap allocates one.
+// If there is no such block, bmap allocates one, next to the
+// block allocated before it if possible, and sets *fresh; the
+// caller must not read the new block from the disk, since it
+// holds garbage, but use bnew(). New indirect blocks are
+// handled here the same way.
+// Blocks past the direct ones are found through a tree of
+// indirect blocks one, two or three levels deep.
+// ip->ext remembers the last run of blocks found to be
+// contiguous on disk, and ip->leaf the last indirect block
+// that pointed at data blocks, so that mapping the blocks of
+// a sequential read or write rarely walks the indirect tree.
 static uint
-bmap(struct inode *ip, uint bn)
+bmap(struct inode *ip, uint bn, int *fresh)
 {
-  uint addr, *a;
+  uint addr, *a, goal, base, n, leafbase, level, d, i;
   struct buf *bp;
+  int new;
+
+  *fresh = 0;
+  if(bn >= ip->ext.lbn && bn - ip->ext.lbn < ip->ext.len)
+    return ip->ext.pbn + (bn - ip->ext.lbn);
+  goal = ip->ext.len > 0 ? ip->ext.pbn + ip->ext.len : 0;
 
   if(bn < NDIRECT){
-    if((addr = ip->addrs[bn]) == 0)
-      ip->addrs[bn] = addr = balloc(ip->dev);
-    return addr;
-  }
-  bn -= NDIRECT;
-
-  if(bn < NINDIRECT){
-    // Load indirect block, allocating if necessary.
-    if((addr = ip->addrs[NDIRECT]) == 0)
-      ip->addrs[NDIRECT] = addr = balloc(ip->dev);
-    bp = bread(ip->dev, addr);
-    a = (uint*)bp->data;
-    if((addr = a[bn]) == 0){
-      a[bn] = addr = balloc(ip->dev);
-      log_write(bp);
+    if((addr = ip->addrs[bn]) == 0){
+      ip->addrs[bn] = addr = balloc(ip->dev, goal);
+      *fresh = 1;
     }
-    brelse(bp);
-    return addr;
+    goto found;
+  }
+
+  // Which tree is bn in?  It covers n blocks from base.
+  base = NDIRECT;
+  n = NINDIRECT;
+  for(level = 1; bn - base >= n; level++){
+    if(level == 3)
+      panic("bmap: out of range");
+    base += n;
+    n *= NINDIRECT;
+  }
+
+  leafbase = bn - (bn - base) % NINDIRECT;
+  new = 0;
+  if(ip->leaf.addr != 0 && ip->leaf.lbn == leafbase){
+    addr = ip->leaf.addr;
+  } else {
+    // Walk down to the leaf, allocating blocks as necessary.
+    // A new indirect block always gets a pointer logged in it.
+    if((addr = ip->addrs[NDIRECT+level-1]) == 0){
+      ip->addrs[NDIRECT+level-1] = addr = balloc(ip->dev, goal);
+      new = 1;
+    }
+    for(d = level; d > 1; d--){
+      n /= NINDIRECT;
+      bp = new ? bnew(ip->dev, addr) : bread(ip->dev, addr);
+      a = (uint*)bp->data;
+      i = (bn - base) / n % NINDIRECT;
+      new = 0;
+      if((addr = a[i]) == 0){
+        a[i] = addr = balloc(ip->dev, goal);
+        log_write(bp);
+        new = 1;
+      }
+      brelse(bp);
+    }
+    ip->leaf.lbn = leafbase;
+    ip->leaf.addr = addr;
+  }
+
+  bp = new ? bnew(ip->dev, addr) : bread(ip->dev, addr);
+  a = (uint*)bp->data;
+  i = bn - leafbase;
+  if((addr = a[i]) == 0){
+    if(goal == 0)
+      goal = i > 0 && a[i-1] ? a[i-1] + 1 : ip->leaf.addr + 1;
+    a[i] = addr = balloc(ip->dev, goal);
+    log_write(bp);
+    *fresh = 1;
+  }
+  brelse(bp);
+
+found:
+  if(ip->ext.len > 0 && bn == ip->ext.lbn + ip->ext.len &&
+     addr == ip->ext.pbn + ip->ext.len){
+    ip->ext.len++;
+  } else {
+    ip->ext.lbn = bn;
+    ip->ext.pbn = addr;
+    ip->ext.len = 1;
   }
+  return addr;
+}
+
+// Return a locked buf holding block bn of inode ip, which
+// bmap() allocates if necessary. A newly allocated block is
+// zeroed in the cache, without reading it from the disk, and
+// logged, so the caller may write as much or as little of it
+// as it likes.
+static struct buf*
+bmapread(struct inode *ip, uint bn)
+{
+  struct buf *bp;
+  uint addr;
+  int fresh;
 
-  panic("bmap: out of range");
+  addr = bmap(ip, bn, &fresh);
+  if(!fresh)
+    return bread(ip->dev, addr);
+  bp = bnew(ip->dev, addr);
+  log_write(bp);
+  return bp;
+}
+
+// Free indirect block addr and the blocks it points to,
+// which are themselves indirect blocks if level > 1.
+static void
+bfreeind(uint dev, uint addr, int level)
+{
+  struct buf *bp;
+  uint *a;
+  int j;
+
+  bp = bread(dev, addr);
+  a = (uint*)bp->data;
+  for(j = 0; j < NINDIRECT; j++){
+    if(a[j] == 0)
+      continue;
+    if(level > 1)
+      bfreeind(dev, a[j], level-1);
+    else
+      bfree(dev, a[j]);
+  }
+  brelse(bp);
+  bfree(dev, addr);
 }
 
 // Truncate inode (discard contents).
@@ -409,9 +658,7 @@ bmap(struct inode *ip, uint bn)
 void
 itrunc(struct inode *ip)
 {
-  int i, j;
-  struct buf *bp;
-  uint *a;
+  int i;
 
   for(i = 0; i < NDIRECT; i++){
     if(ip->addrs[i]){
@@ -420,18 +667,16 @@ itrunc(struct inode *ip)
     }
   }
 
-  if(ip->addrs[NDIRECT]){
-    bp = bread(ip->dev, ip->addrs[NDIRECT]);
-    a = (uint*)bp->data;
-    for(j = 0; j < NINDIRECT; j++){
-      if(a[j])
-        bfree(ip->dev, a[j]);
+  for(i = 0; i < 3; i++){
+    if(ip->addrs[NDIRECT+i]){
+      bfreeind(ip->dev, ip->addrs[NDIRECT+i], i+1);
+      ip->addrs[NDIRECT+i] = 0;
     }
-    brelse(bp);
-    bfree(ip->dev, ip->addrs[NDIRECT]);
-    ip->addrs[NDIRECT] = 0;
   }
 
+  ip->ext.len = 0;
+  ip->leaf.addr = 0;
+  memset(&ip->ra, 0, sizeof(ip->ra));
   ip->size = 0;
   iupdate(ip);
 }
@@ -448,6 +693,42 @@ stati(struct inode *ip, struct stat *st)
   st->size = ip->size;
 }
 
+// Sequential read-ahead for a read of n > 0 bytes at off.
+// A read that starts where the previous one ended doubles
+// ip->ra.win, up to NREADAHEAD blocks; any other read turns
+// read-ahead off. Blocks of this read after its first, and
+// up to ip->ra.win blocks past it, are started with
+// breadahead(), each only once, so that the disk is busy
+// with them while readi() copies out earlier ones.
+static void
+readahead(struct inode *ip, uint off, uint n)
+{
+  uint bn, end, nb;
+  int fresh;
+
+  if(off == ip->ra.off){
+    ip->ra.win = ip->ra.win ? min(2*ip->ra.win, NREADAHEAD) : 2;
+  } else {
+    ip->ra.win = 0;
+    ip->ra.end = 0;
+  }
+  ip->ra.off = off + n;
+  if(ip->ra.win == 0)
+    return;
+
+  nb = (ip->size + BSIZE - 1) / BSIZE;
+  end = min((off + n - 1) / BSIZE + 1 + ip->ra.win, nb);
+  bn = off / BSIZE + 1;
+  if(bn < ip->ra.end)
+    bn = ip->ra.end;
+  blk_plug();
+  for(; bn < end; bn++)
+    breadahead(ip->dev, bmap(ip, bn, &fresh));  // bn < nb: never fresh
+  blk_unplug();
+  if(end > ip->ra.end)
+    ip->ra.end = end;
+}
+
 // Read data from inode.
 // Caller must hold ip->lock.
 // If user_dst==1, then dst is a user virtual address;
@@ -462,9 +743,11 @@ readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
     return 0;
   if(off + n > ip->size)
     n = ip->size - off;
+  if(n > 0)
+    readahead(ip, off, n);
 
   for(tot=0; tot<n; tot+=m, off+=m, dst+=m){
-    bp = bread(ip->dev, bmap(ip, off/BSIZE));
+    bp = bmapread(ip, off/BSIZE);
     m = min(n - tot, BSIZE - off%BSIZE);
     if(either_copyout(user_dst, dst, bp->data + (off % BSIZE), m) == -1) {
       brelse(bp);
@@ -491,11 +774,11 @@ writei(struct inode *ip, int user_src, uint64 src, uint off, uint n)
 
   if(off > ip->size || off + n < off)
     return -1;
-  if(off + n > MAXFILE*BSIZE)
+  if(off + n > (uint64)MAXFILE*BSIZE)
     return -1;
 
   for(tot=0; tot<n; tot+=m, off+=m, src+=m){
-    bp = bread(ip->dev, bmap(ip, off/BSIZE));
+    bp = bmapread(ip, off/BSIZE);
     m = min(n - tot, BSIZE - off%BSIZE);
     if(either_copyin(bp->data + (off % BSIZE), user_src, src, m) == -1) {
       brelse(bp);
@@ -524,32 +807,347 @@ namecmp(const char *s, const char *t)
   return strncmp(s, t, DIRSIZ);
 }
 
+// Directory name lookup cache.
+//
+// The dcache remembers the result of recent dirlookup()s:
+// for a (dev, directory inum, name) triple it holds the inum
+// the name refers to and the byte offset of its dirent, or
+// inum 0 if the directory was found not to contain the name.
+// A hit lets dirlookup() skip the scan of the directory's
+// blocks (and the buffer cache) altogether.
+//
+// Entries for a directory are only read or changed by a caller
+// that holds that directory's ip->lock, the same lock that
+// guards its contents, so a cached answer cannot go stale
+// behind a lookup's back.  dirlink() records the new name,
+// sys_unlink() drops the removed one, and freeing a directory
+// inode drops everything cached under it.  dcache.lock only
+// protects the hash chains and the LRU list.
+
+#define NDHASH 67
+
+struct dentry {
+  uint dev;
+  uint dinum;           // directory's inum; 0 if entry unused
+  uint inum;            // inum of the named file; 0 if absent
+  uint off;             // byte offset of the dirent in directory
+  char name[DIRSIZ];
+  struct dentry *hnext; // hash chain
+  struct dentry *prev;  // LRU list
+  struct dentry *next;
+};
+
+struct {
+  struct spinlock lock;
+  struct dentry dentry[NDENTRY];
+  struct dentry *hash[NDHASH];
+
+  // Linked list of all entries, through prev/next.
+  // head.next is most recently used, head.prev is least.
+  struct dentry head;
+} dcache;
+
+static void
+dcacheinit(void)
+{
+  struct dentry *d;
+
+  initlock(&dcache.lock, "dcache");
+  dcache.head.prev = &dcache.head;
+  dcache.head.next = &dcache.head;
+  for(d = dcache.dentry; d < dcache.dentry+NDENTRY; d++){
+    d->next = dcache.head.next;
+    d->prev = &dcache.head;
+    dcache.head.next->prev = d;
+    dcache.head.next = d;
+  }
+}
+
+static uint
+dhash(uint dev, uint dinum, char *name)
+{
+  uint h;
+  int i;
+
+  h = dev*31 + dinum;
+  for(i = 0; i < DIRSIZ && name[i]; i++)
+    h = h*31 + (uchar)name[i];
+  return h % NDHASH;
+}
+
+// Find the entry for name in directory (dev, dinum).
+// Caller must hold dcache.lock.
+static struct dentry*
+dfind(uint dev, uint dinum, char *name)
+{
+  struct dentry *d;
+
+  for(d = dcache.hash[dhash(dev, dinum, name)]; d; d = d->hnext)
+    if(d->dev == dev && d->dinum == dinum && namecmp(d->name, name) == 0)
+      return d;
+  return 0;
+}
+
+// Move d to the most-recently-used end of the list.
+// Caller must hold dcache.lock.
+static void
+dtouch(struct dentry *d)
+{
+  d->next->prev = d->prev;
+  d->prev->next = d->next;
+  d->next = dcache.head.next;
+  d->prev = &dcache.head;
+  dcache.head.next->prev = d;
+  dcache.head.next = d;
+}
+
+// Remove d from its hash chain and move it to the
+// least-recently-used end of the list, so it is reused first.
+// Caller must hold dcache.lock.
+static void
+dremove(struct dentry *d)
+{
+  struct dentry **pp;
+
+  if(d->dinum == 0)
+    return;
+  for(pp = &dcache.hash[dhash(d->dev, d->dinum, d->name)]; *pp; pp = &(*pp)->hnext){
+    if(*pp == d){
+      *pp = d->hnext;
+      break;
+    }
+  }
+  d->dinum = 0;
+  d->hnext = 0;
+  d->next->prev = d->prev;
+  d->prev->next = d->next;
+  d->prev = dcache.head.prev;
+  d->next = &dcache.head;
+  dcache.head.prev->next = d;
+  dcache.head.prev = d;
+}
+
+// Look name up in the cache for directory dp.
+// Returns 1 and sets *inum and *off on a hit; *inum is 0
+// if the name is known not to exist.
+// Caller must hold dp->lock.
+static int
+dcache_lookup(struct inode *dp, char *name, uint *inum, uint *off)
+{
+  struct dentry *d;
+
+  acquire(&dcache.lock);
+  if((d = dfind(dp->dev, dp->inum, name)) == 0){
+    release(&dcache.lock);
+    return 0;
+  }
+  *inum = d->inum;
+  *off = d->off;
+  dtouch(d);
+  release(&dcache.lock);
+  return 1;
+}
+
+// Record that name in directory dp refers to inum, at byte
+// offset off (inum 0: name is absent from dp).
+// Caller must hold dp->lock.
+static void
+dcache_enter(struct inode *dp, char *name, uint inum, uint off)
+{
+  struct dentry *d;
+
+  acquire(&dcache.lock);
+  if((d = dfind(dp->dev, dp->inum, name)) != 0)
+    dremove(d);
+  // Recycle the least recently used entry.
+  d = dcache.head.prev;
+  dremove(d);
+  d->dev = dp->dev;
+  d->dinum = dp->inum;
+  d->inum = inum;
+  d->off = off;
+  strncpy(d->name, name, DIRSIZ);
+  d->hnext = dcache.hash[dhash(d->dev, d->dinum, d->name)];
+  dcache.hash[dhash(d->dev, d->dinum, d->name)] = d;
+  dtouch(d);
+  release(&dcache.lock);
+}
+
+// Forget what the cache knows about name in directory dp.
+// Called when the dirent is removed.
+// Caller must hold dp->lock.
+void
+dcache_forget(struct inode *dp, char *name)
+{
+  struct dentry *d;
+
+  acquire(&dcache.lock);
+  if((d = dfind(dp->dev, dp->inum, name)) != 0)
+    dremove(d);
+  release(&dcache.lock);
+}
+
+// Forget every entry cached for directory (dev, dinum),
+// whose inode is being freed and may be reused.
+static void
+dcache_purge(uint dev, uint dinum)
+{
+  struct dentry *d;
+
+  acquire(&dcache.lock);
+  for(d = dcache.dentry; d < dcache.dentry+NDENTRY; d++)
+    if(d->dinum == dinum && d->dev == dev)
+      dremove(d);
+  release(&dcache.lock);
+}
+
+// Look for name in block bn of directory dp.
+// Returns its inum, and sets *poff to the byte offset of its
+// dirent, if found.  Sets *ovf if the bucket has overflowed.
+static uint
+dirfind(struct inode *dp, uint bn, char *name, uint *poff, int *ovf)
+{
+  struct buf *bp;
+  struct dirent *de;
+  uint i, inum;
+
+  bp = bmapread(dp, bn);
+  de = (struct dirent*)bp->data;
+  inum = 0;
+  for(i = 0; i < DPB-1; i++){
+    if(de[i].inum != 0 && namecmp(name, de[i].name) == 0){
+      // entry matches path element
+      inum = de[i].inum;
+      *poff = bn*BSIZE + i*sizeof(struct dirent);
+      break;
+    }
+  }
+  if(ovf)
+    *ovf = de[DPB-1].name[0] != 0;
+  brelse(bp);
+  return inum;
+}
+
 // Look for a directory entry in a directory.
 // If found, set *poff to byte offset of entry.
 struct inode*
 dirlookup(struct inode *dp, char *name, uint *poff)
 {
-  uint off, inum;
-  struct dirent de;
+  uint nb, b, bn, off, inum;
+  int ovf;
 
   if(dp->type != T_DIR)
     panic("dirlookup not DIR");
 
-  for(off = 0; off < dp->size; off += sizeof(de)){
-    if(readi(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
-      panic("dirlookup read");
-    if(de.inum == 0)
-      continue;
-    if(namecmp(name, de.name) == 0){
-      // entry matches path element
-      if(poff)
-        *poff = off;
-      inum = de.inum;
-      return iget(dp->dev, inum);
+  if(dcache_lookup(dp, name, &inum, &off)){
+    if(inum == 0)
+      return 0;
+    if(poff)
+      *poff = off;
+    return iget(dp->dev, inum);
+  }
+
+  inum = 0;
+  nb = dp->size / BSIZE;
+  if(nb > 0){
+    b = dirbucket(dirhash(name), nb);
+    inum = dirfind(dp, b, name, &off, &ovf);
+    // Entries of an overflowed bucket may be in any block.
+    for(bn = 0; inum == 0 && ovf && bn < nb; bn++)
+      if(bn != b)
+        inum = dirfind(dp, bn, name, &off, 0);
+  }
+
+  if(inum == 0){
+    dcache_enter(dp, name, 0, 0);
+    return 0;
+  }
+  if(poff)
+    *poff = off;
+  dcache_enter(dp, name, inum, off);
+  return iget(dp->dev, inum);
+}
+
+// Put the entry (name, inum) in a free slot of block bn of
+// directory dp. Returns the byte offset of the new dirent,
+// or -1 if the block is full.
+static int
+dirput(struct inode *dp, uint bn, char *name, uint inum)
+{
+  struct buf *bp;
+  struct dirent *de;
+  uint i;
+
+  bp = bmapread(dp, bn);
+  de = (struct dirent*)bp->data;
+  for(i = 0; i < DPB-1; i++){
+    if(de[i].inum == 0){
+      strncpy(de[i].name, name, DIRSIZ);
+      de[i].inum = inum;
+      log_write(bp);
+      brelse(bp);
+      return bn*BSIZE + i*sizeof(struct dirent);
     }
   }
+  brelse(bp);
+  return -1;
+}
 
-  return 0;
+// Mark bucket bn of directory dp as overflowed.
+static void
+dirmark(struct inode *dp, uint bn)
+{
+  struct buf *bp;
+  struct dirent *de;
+
+  bp = bmapread(dp, bn);
+  de = (struct dirent*)bp->data;
+  if(de[DPB-1].name[0] == 0){
+    de[DPB-1].name[0] = 1;
+    log_write(bp);
+  }
+  brelse(bp);
+}
+
+// Grow directory dp by one block (bucket), moving the entries
+// that now hash to the new bucket out of the bucket it splits.
+// Returns the number of the bucket that was split.
+static uint
+dirsplit(struct inode *dp)
+{
+  uint nb, s, l, i, j;
+  struct buf *bp, *np;
+  struct dirent *de, *nde;
+
+  nb = dp->size / BSIZE;
+  for(l = 1; l*2 <= nb; l *= 2)
+    ;
+  s = nb - l;
+
+  np = bmapread(dp, nb);
+  dp->size += BSIZE;
+  iupdate(dp);
+
+  bp = bmapread(dp, s);
+  de = (struct dirent*)bp->data;
+  nde = (struct dirent*)np->data;
+  j = 0;
+  for(i = 0; i < DPB-1; i++){
+    if(de[i].inum != 0 && dirbucket(dirhash(de[i].name), nb+1) == nb){
+      nde[j++] = de[i];
+      memset(&de[i], 0, sizeof(de[i]));
+    }
+  }
+  // Entries that overflowed from s may belong to the new bucket.
+  nde[DPB-1] = de[DPB-1];
+  log_write(bp);
+  log_write(np);
+  brelse(bp);
+  brelse(np);
+
+  // Moved entries have new offsets.
+  dcache_purge(dp->dev, dp->inum);
+  return s;
 }
 
 // Write a new directory entry (name, inum) into the directory dp.
@@ -557,7 +1155,7 @@ int
 dirlink(struct inode *dp, char *name, uint inum)
 {
   int off;
-  struct dirent de;
+  uint nb, b, s;
   struct inode *ip;
 
   // Check that name is not present.
@@ -566,18 +1164,31 @@ dirlink(struct inode *dp, char *name, uint inum)
     return -1;
   }
 
-  // Look for an empty dirent.
-  for(off = 0; off < dp->size; off += sizeof(de)){
-    if(readi(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
-      panic("dirlink read");
-    if(de.inum == 0)
-      break;
+  nb = dp->size / BSIZE;
+  if(nb == 0){
+    brelse(bmapread(dp, 0));
+    dp->size = BSIZE;
+    iupdate(dp);
+    nb = 1;
   }
 
-  strncpy(de.name, name, DIRSIZ);
-  de.inum = inum;
-  if(writei(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
-    panic("dirlink");
+  b = dirbucket(dirhash(name), nb);
+  if((off = dirput(dp, b, name, inum)) < 0){
+    // The bucket is full: split one bucket to make room.
+    // Splitting only once per dirlink keeps the number of
+    // blocks written within what a transaction allows.
+    s = dirsplit(dp);
+    b = dirbucket(dirhash(name), nb+1);
+    if((off = dirput(dp, b, name, inum)) < 0){
+      // Still full. Between them, the split bucket and the new
+      // one have a block's worth of free slots.
+      dirmark(dp, b);
+      if((off = dirput(dp, s, name, inum)) < 0 &&
+         (off = dirput(dp, nb, name, inum)) < 0)
+        panic("dirlink");
+    }
+  }
+  dcache_enter(dp, name, inum, off);
 
   return 0;
 }
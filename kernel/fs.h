@@ -24,9 +24,11 @@ struct superblock {
 
 #define FSMAGIC 0x10203040
 
-#define NDIRECT 12
+#define NDIRECT 10
 #define NINDIRECT (BSIZE / sizeof(uint))
-#define MAXFILE (NDIRECT + NINDIRECT)
+#define NDINDIRECT (NINDIRECT * NINDIRECT)
+#define NTINDIRECT (NDINDIRECT * NINDIRECT)
+#define MAXFILE (NDIRECT + NINDIRECT + NDINDIRECT + NTINDIRECT)
 
 // On-disk inode structure
 struct dinode {
@@ -35,7 +37,8 @@ struct dinode {
   short minor;          // Minor device number (T_DEVICE only)
   short nlink;          // Number of links to inode in file system
   uint size;            // Size of file (bytes)
-  uint addrs[NDIRECT+1];   // Data block addresses
+  uint addrs[NDIRECT+3];   // Data block addresses, then singly,
+                           // doubly and triply indirect blocks
 };
 
 // Inodes per block.
@@ -58,3 +61,35 @@ struct dirent {
   char name[DIRSIZ];
 };
 
+// A directory is also a hash table: each of its blocks is a
+// bucket of DPB dirents, and dirbucket() picks a name's bucket
+// by linear hashing over the number of blocks, so a directory
+// grows one bucket (block) at a time.  A one-block directory
+// is just a plain list of entries.  The last dirent of each
+// block is never used for an entry; a nonzero name[0] there
+// marks a bucket whose entries have overflowed into other blocks.
+#define DPB (BSIZE / sizeof(struct dirent))
+
+static inline uint
+dirhash(const char *name)
+{
+  uint h = 2166136261U;
+  int i;
+
+  for(i = 0; i < DIRSIZ && name[i]; i++)
+    h = (h ^ (unsigned char)name[i]) * 16777619U;
+  return h;
+}
+
+// Bucket of hash h in a directory of nb (> 0) blocks.
+static inline uint
+dirbucket(uint h, uint nb)
+{
+  uint l;
+
+  for(l = 1; l*2 <= nb; l *= 2)
+    ;
+  if((h & (l-1)) < nb - l)
+    return h & (2*l-1);
+  return h & (l-1);
+}
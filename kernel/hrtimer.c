@@ -0,0 +1,179 @@
+// High-resolution time: a nanosecond clock read from the
+// time CSR, and nanosleep() on one-shot timer interrupts.
+//
+// Each hart keeps a min-heap of the sleepers that started
+// on it, ordered by wake-up time. The earliest time goes in
+// timer_scratch[hart][SCRATCH_DEADLINE], and timervec
+// (kernelvec.S) has the CLINT interrupt then as well as at
+// each periodic tick, so a sleep ends soon after its time
+// rather than at the next tick.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "defs.h"
+
+#define NS 1000000000L  // nanoseconds per second
+
+extern uint64 timer_scratch[NCPU][NSCRATCH];
+
+struct sleeper {
+  uint64 when;    // time CSR value to wake at
+  int fired;
+};
+
+struct hrtimer {
+  struct spinlock lock;
+  struct sleeper *heap[NPROC];  // heap[0] wakes first
+  int n;
+  uint64 ticks;   // periodic interrupts seen by hrtimerintr()
+} hrtimer[NCPU];
+
+void
+hrtimerinit(void)
+{
+  int i;
+
+  for(i = 0; i < NCPU; i++)
+    initlock(&hrtimer[i].lock, "hrtimer");
+}
+
+// Nanoseconds since boot.
+uint64
+nsnow(void)
+{
+  uint64 t = r_time();
+
+  return t / CLINT_FREQ * NS + t % CLINT_FREQ * NS / CLINT_FREQ;
+}
+
+static void
+swap(struct hrtimer *h, int i, int j)
+{
+  struct sleeper *s = h->heap[i];
+
+  h->heap[i] = h->heap[j];
+  h->heap[j] = s;
+}
+
+static void
+siftup(struct hrtimer *h, int i)
+{
+  while(i > 0 && h->heap[(i-1)/2]->when > h->heap[i]->when){
+    swap(h, i, (i-1)/2);
+    i = (i-1)/2;
+  }
+}
+
+static void
+siftdown(struct hrtimer *h, int i)
+{
+  int c;
+
+  for(;;){
+    c = 2*i + 1;
+    if(c >= h->n)
+      break;
+    if(c+1 < h->n && h->heap[c+1]->when < h->heap[c]->when)
+      c++;
+    if(h->heap[i]->when <= h->heap[c]->when)
+      break;
+    swap(h, i, c);
+    i = c;
+  }
+}
+
+// Remove heap[i].
+static void
+heapdel(struct hrtimer *h, int i)
+{
+  h->heap[i] = h->heap[--h->n];
+  if(i < h->n){
+    siftdown(h, i);
+    siftup(h, i);
+  }
+}
+
+// Have timervec interrupt hart id, the one we are on,
+// when its first sleeper is due. Caller holds the lock.
+static void
+program(int id)
+{
+  struct hrtimer *h = &hrtimer[id];
+  uint64 when = h->n > 0 ? h->heap[0]->when : -1;
+
+  if(timer_scratch[id][SCRATCH_DEADLINE] != when){
+    timer_scratch[id][SCRATCH_DEADLINE] = when;
+    // interrupt now, so timervec sets the CLINT's
+    // next interrupt from the new deadline.
+    *(uint64*)CLINT_MTIMECMP(id) = 0;
+  }
+}
+
+// Called on each software interrupt that timervec raises.
+// Wakes this hart's sleepers whose time has come, and
+// returns the number of periodic ticks since the last call.
+int
+hrtimerintr(void)
+{
+  int id = cpuid();
+  struct hrtimer *h = &hrtimer[id];
+  struct sleeper *s;
+  uint64 now, t;
+  int n;
+
+  acquire(&h->lock);
+  now = r_time();
+  while(h->n > 0 && h->heap[0]->when <= now){
+    s = h->heap[0];
+    heapdel(h, 0);
+    s->fired = 1;
+    wakeup(s);
+  }
+  program(id);
+  t = timer_scratch[id][SCRATCH_TICKS];
+  n = t - h->ticks;
+  h->ticks = t;
+  release(&h->lock);
+  return n;
+}
+
+// Sleep for ns nanoseconds. Returns -1 if killed.
+int
+nanosleep(uint64 ns)
+{
+  struct proc *p = myproc();
+  struct hrtimer *h;
+  struct sleeper s;
+  int id, i;
+
+  s.when = r_time() + ns / NS * CLINT_FREQ + (ns % NS * CLINT_FREQ + NS - 1) / NS;
+  s.fired = 0;
+
+  push_off();
+  id = cpuid();
+  h = &hrtimer[id];
+  acquire(&h->lock);
+  pop_off();
+  h->heap[h->n++] = &s;
+  siftup(h, h->n - 1);
+  program(id);
+
+  // once asleep, p may move to another hart; the sleeper
+  // stays on this one's heap.
+  while(!s.fired && !p->killed)
+    sleep(&s, &h->lock);
+  if(!s.fired){
+    for(i = 0; i < h->n; i++){
+      if(h->heap[i] == &s){
+        heapdel(h, i);
+        break;
+      }
+    }
+  }
+  release(&h->lock);
+  return s.fired ? 0 : -1;
+}
@@ -0,0 +1,31 @@
+// Batched system calls: ioring_enter() interface.
+//
+// A process fills in submission entries (sq) at sqtail and
+// calls ioring_enter(), which runs the system calls from
+// sqhead up to sqtail and posts their results as completion
+// entries (cq) at cqtail. The indices only increase; entry i
+// is at [i % IORING_SIZE]. The kernel stops early if the
+// completion ring is full (cqtail - cqhead == IORING_SIZE).
+
+#define IORING_SIZE 32
+
+struct io_sqe {
+  int op;           // system call number: SYS_read, SYS_write,
+                    // SYS_open, SYS_close or SYS_fstat
+  uint64 arg[3];    // its arguments
+  uint64 data;      // copied to the completion, for the caller
+};
+
+struct io_cqe {
+  uint64 data;      // from the submission
+  int res;          // the system call's return value
+};
+
+struct ioring {
+  uint sqhead;      // next submission to run (set by the kernel)
+  uint sqtail;      // next free submission (set by the caller)
+  uint cqhead;      // next completion to consume (set by the caller)
+  uint cqtail;      // next free completion (set by the kernel)
+  struct io_sqe sq[IORING_SIZE];
+  struct io_cqe cq[IORING_SIZE];
+};
@@ -21,35 +21,82 @@
 // But if it thinks the log is close to running out, it
 // sleeps until the last outstanding end_op() commits.
 //
+// If LOGDELAY is set, durability is relaxed: end_op() does
+// not commit, so the updates of many system calls collect in
+// the log (pinned in the buffer cache) and reach the disk in
+// one commit. A kernel thread commits every LOGDELAY ticks;
+// end_op() still commits when the log is nearly full, and
+// log_sync() (fsync() and sync()) commits on demand.
+//
 // The log is a physical re-do log containing disk blocks.
-// The on-disk log format:
-//   header block, containing block #s for block A, B, C, ...
-//   block A
-//   block B
-//   block C
-//   ...
+// It is a circular journal: each commit appends a transaction
+// at the head, and checkpointing, which writes the logged
+// blocks to their home locations, frees the space from the
+// tail. The on-disk log format:
+//   journal superblock, containing the position and sequence
+//     number of the oldest transaction not yet checkpointed
+//   transactions, each:
+//     header block, containing a sequence number, a checksum,
+//       and block #s for block A, B, C, ...
+//     block A
+//     block B
+//     block C
+//     ...
+// A transaction may wrap around the end of the log.
+// A commit writes the header and the blocks together. The
+// checksum covers the header and the logged blocks, and
+// the sequence numbers count up from the tail, so recovery
+// can tell a transaction that reached the disk whole from
+// one cut short by a crash, or from a stale one left by an
+// earlier trip around the log.
+//
+// Checkpointing is lazy. A committed block stays pinned in
+// the buffer cache, where later transactions may log it again,
+// until the log is nearly full or too many blocks are pinned.
+// Then all of them are written home together, and the journal
+// superblock is updated to free the log. A block modified by
+// many transactions is written home once.
 // Log appends are synchronous.
 
 // Contents of the header block, used for both the on-disk header block
 // and to keep track in memory of logged block# before commit.
 struct logheader {
+  uint seq;    // transaction sequence number
+  uint cksum;  // of the header block (with cksum 0) and the logged blocks
   int n;
   int block[LOGSIZE];
 };
 
+// Contents of the log's first block.
+struct logsuper {
+  uint seq;    // sequence number of the transaction at tail
+  uint tail;   // position of the oldest transaction to install
+};
+
 struct log {
   struct spinlock lock;
   int start;
-  int size;
+  int size;        // log blocks after the journal superblock
+  int txmax;       // most blocks in one transaction
   int outstanding; // how many FS sys calls are executing.
   int committing;  // in commit(), please wait.
+  int flushreq;    // log_sync() wants the next end_op() to commit.
+  int ncommit;     // number of commits done so far.
   int dev;
+  int head;        // position of the next transaction
+  int used;        // blocks from the tail up to head
+  int nckpt;       // committed blocks waiting to be written home
+  struct buf *ckpt[NCKPT];
+  struct buf *buf[LOGSIZE]; // cached bufs of the blocks in lh
   struct logheader lh;
 };
 struct log log;
 
+#define CKSUMINIT 2166136261U  // FNV-1a offset basis
+
 static void recover_from_log(void);
 static void commit();
+static void log_flusher(void);
 
 void
 initlog(int dev, struct superblock *sb)
@@ -59,56 +106,109 @@ initlog(int dev, struct superblock *sb)
 
   initlock(&log.lock, "log");
   log.start = sb->logstart;
-  log.size = sb->nlog;
+  log.size = sb->nlog - 1;
   log.dev = dev;
+  // a transaction and its header must fit in an empty log.
+  log.txmax = LOGSIZE;
+  if (log.txmax > log.size - 1)
+    log.txmax = log.size - 1;
+  if (log.txmax < MAXOPBLOCKS)
+    panic("initlog: log too small");
   recover_from_log();
+  if(LOGDELAY && kthread(log_flusher, "logflush") < 0)
+    panic("initlog: flusher");
+}
+
+// Disk block holding log position pos.
+static int
+logblock(int pos)
+{
+  return log.start + 1 + pos % log.size;
 }
 
-// Copy committed blocks from log to their home location
+// Copy the blocks of the committed transaction in log.lh,
+// whose header is at log position pos, from the log to their
+// home locations. Runs of consecutive home blocks are written
+// with one request. Only for recovery: during normal operation
+// checkpoint() writes the cached copies instead.
 static void
-install_trans(int recovering)
+install_trans(int pos)
 {
-  int tail;
+  struct buf *dbuf[MAXBIOVEC];
+  int tail, n, i;
 
-  for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *lbuf = bread(log.dev, log.start+tail+1); // read log block
-    struct buf *dbuf = bread(log.dev, log.lh.block[tail]); // read dst
-    memmove(dbuf->data, lbuf->data, BSIZE);  // copy block to dst
-    bwrite(dbuf);  // write dst to disk
-    if(recovering == 0)
-      bunpin(dbuf);
-    brelse(lbuf);
-    brelse(dbuf);
+  for (tail = 0; tail < log.lh.n; tail += n) {
+    for (n = 0; n < MAXBIOVEC && tail+n < log.lh.n; n++) {
+      if (n > 0 && log.lh.block[tail+n] != log.lh.block[tail]+n)
+        break;
+      struct buf *lbuf = bread(log.dev, logblock(pos+tail+n+1)); // read log block
+      dbuf[n] = bread(log.dev, log.lh.block[tail+n]); // read dst
+      memmove(dbuf[n]->data, lbuf->data, BSIZE);  // copy block to dst
+      brelse(lbuf);
+    }
+    bwritev(dbuf, n, 0);  // write dst to disk
+    for (i = 0; i < n; i++)
+      brelse(dbuf[i]);
   }
 }
 
-// Read the log header from disk into the in-memory log header
-static void
-read_head(void)
+// Add the n bytes at p (n a multiple of 4) to checksum sum.
+// FNV-1a, a word at a time.
+static uint
+cksum(uint sum, void *p, int n)
 {
-  struct buf *buf = bread(log.dev, log.start);
-  struct logheader *lh = (struct logheader *) (buf->data);
+  uint *w = (uint *) p;
   int i;
-  log.lh.n = lh->n;
-  for (i = 0; i < log.lh.n; i++) {
-    log.lh.block[i] = lh->block[i];
+
+  for (i = 0; i < n/4; i++)
+    sum = (sum ^ w[i]) * 16777619;
+  return sum;
+}
+
+// Read the header at log position pos into the in-memory log
+// header. Return 0, leaving log.lh.n 0, unless it is transaction
+// seq and its checksum matches; if not, no later commit finished.
+static int
+read_head(int pos, uint seq)
+{
+  struct buf *buf = bread(log.dev, logblock(pos));
+  struct logheader *lh = (struct logheader *) (buf->data);
+  uint sum, want;
+  int i, ok;
+
+  ok = 0;
+  log.lh.n = 0;
+  if (lh->seq == seq && lh->n > 0 && lh->n <= log.txmax) {
+    want = lh->cksum;
+    lh->cksum = 0;
+    sum = cksum(CKSUMINIT, buf->data, BSIZE);
+    lh->cksum = want;
+    for (i = 0; i < lh->n; i++) {
+      struct buf *lbuf = bread(log.dev, logblock(pos+i+1));
+      sum = cksum(sum, lbuf->data, BSIZE);
+      brelse(lbuf);
+    }
+    if (sum == want) {
+      log.lh.n = lh->n;
+      for (i = 0; i < log.lh.n; i++)
+        log.lh.block[i] = lh->block[i];
+      ok = 1;
+    }
   }
   brelse(buf);
+  return ok;
 }
 
-// Write in-memory log header to disk.
-// This is the true point at which the
-// current transaction commits.
+// Record in the journal superblock that everything before
+// log position tail, up to transaction seq, is installed.
 static void
-write_head(void)
+write_super(int tail, uint seq)
 {
   struct buf *buf = bread(log.dev, log.start);
-  struct logheader *hb = (struct logheader *) (buf->data);
-  int i;
-  hb->n = log.lh.n;
-  for (i = 0; i < log.lh.n; i++) {
-    hb->block[i] = log.lh.block[i];
-  }
+  struct logsuper *ls = (struct logsuper *) (buf->data);
+
+  ls->seq = seq;
+  ls->tail = tail;
   bwrite(buf);
   brelse(buf);
 }
@@ -116,10 +216,30 @@ write_head(void)
 static void
 recover_from_log(void)
 {
-  read_head();
-  install_trans(1); // if committed, copy from log to disk
+  struct buf *buf;
+  struct logsuper *ls;
+  int pos, nscan;
+  uint seq;
+
+  buf = bread(log.dev, log.start);
+  ls = (struct logsuper *) (buf->data);
+  seq = ls->seq;
+  pos = ls->tail % log.size;
+  brelse(buf);
+
+  // install each committed transaction from the tail on,
+  // stopping at the first that isn't whole or isn't the
+  // next in sequence.
+  for (nscan = 0; read_head(pos, seq) && nscan+log.lh.n+1 <= log.size; seq++) {
+    install_trans(pos); // copy from log to disk
+    nscan += log.lh.n + 1;
+    pos = (pos + log.lh.n + 1) % log.size;
+  }
   log.lh.n = 0;
-  write_head(); // clear the log
+  log.lh.seq = seq;
+  log.head = pos;
+  log.used = 0;
+  write_super(pos, seq); // clear the log
 }
 
 // called at the start of each FS system call.
@@ -130,7 +250,7 @@ begin_op(void)
   while(1){
     if(log.committing){
       sleep(&log, &log.lock);
-    } else if(log.lh.n + (log.outstanding+1)*MAXOPBLOCKS > LOGSIZE){
+    } else if(log.lh.n + (log.outstanding+1)*MAXOPBLOCKS > log.txmax){
       // this op might exhaust log space; wait for commit.
       sleep(&log, &log.lock);
     } else {
@@ -141,20 +261,39 @@ begin_op(void)
   }
 }
 
+// Commit the log, with log.lock held; returns with it held.
+// Caller has checked that no FS system calls are executing
+// and none is committing.
+static void
+docommit(void)
+{
+  log.committing = 1;
+  log.flushreq = 0;
+  release(&log.lock);
+
+  // call commit w/o holding locks, since not allowed
+  // to sleep with locks.
+  commit();
+
+  acquire(&log.lock);
+  log.committing = 0;
+  log.ncommit++;
+  wakeup(&log);
+}
+
 // called at the end of each FS system call.
-// commits if this was the last outstanding operation.
+// commits if this was the last outstanding operation,
+// unless commits are delayed and the log has room.
 void
 end_op(void)
 {
-  int do_commit = 0;
-
   acquire(&log.lock);
   log.outstanding -= 1;
   if(log.committing)
     panic("log.committing");
-  if(log.outstanding == 0){
-    do_commit = 1;
-    log.committing = 1;
+  if(log.outstanding == 0 &&
+     (!LOGDELAY || log.flushreq || log.lh.n + MAXOPBLOCKS > log.txmax)){
+    docommit();
   } else {
     // begin_op() may be waiting for log space,
     // and decrementing log.outstanding has decreased
@@ -162,43 +301,158 @@ end_op(void)
     wakeup(&log);
   }
   release(&log.lock);
+}
 
-  if(do_commit){
-    // call commit w/o holding locks, since not allowed
-    // to sleep with locks.
-    commit();
-    acquire(&log.lock);
-    log.committing = 0;
-    wakeup(&log);
+// Commit everything logged so far and wait until it is
+// on disk. Must not be called inside a transaction.
+void
+log_sync(void)
+{
+  int target;
+
+  acquire(&log.lock);
+  if(log.lh.n == 0 && !log.committing){
     release(&log.lock);
+    return;
+  }
+  // no op can log a block during a commit, so the
+  // commit in progress (or else the next) covers all.
+  target = log.ncommit + 1;
+  while(log.ncommit < target){
+    if(!log.committing && log.outstanding == 0){
+      docommit();
+    } else {
+      log.flushreq = 1;
+      sleep(&log, &log.lock);
+    }
+  }
+  release(&log.lock);
+}
+
+// Body of the kernel thread that commits the
+// log every LOGDELAY ticks when commits are delayed.
+static void
+log_flusher(void)
+{
+  uint ticks0;
+
+  for(;;){
+    acquire(&tickslock);
+    ticks0 = ticks;
+    while(ticks - ticks0 < LOGDELAY)
+      sleep(&ticks, &tickslock);
+    release(&tickslock);
+    log_sync();
   }
 }
 
-// Copy modified blocks from cache to log.
+// Write the header and the modified blocks from the cache
+// to the log at log.head. This is the true point at which the
+// current transaction commits. The block layer merges the
+// consecutive log blocks into as few disk requests as possible;
+// the checksum makes their order unimportant.
 static void
 write_log(void)
 {
+  struct buf *to[LOGSIZE+1];
+  struct logheader *hb;
+  uint sum;
   int tail;
 
+  to[0] = bnew(log.dev, logblock(log.head));  // no need to read what's there
+  hb = (struct logheader *) (to[0]->data);
+  hb->seq = log.lh.seq;
+  hb->n = log.lh.n;
+  for (tail = 0; tail < log.lh.n; tail++)
+    hb->block[tail] = log.lh.block[tail];
+  sum = cksum(CKSUMINIT, to[0]->data, BSIZE);
+
   for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *to = bread(log.dev, log.start+tail+1); // log block
+    to[tail+1] = bnew(log.dev, logblock(log.head+tail+1)); // log block
     struct buf *from = bread(log.dev, log.lh.block[tail]); // cache block
-    memmove(to->data, from->data, BSIZE);
-    bwrite(to);  // write the log
+    memmove(to[tail+1]->data, from->data, BSIZE);
     brelse(from);
-    brelse(to);
+    sum = cksum(sum, to[tail+1]->data, BSIZE);
+  }
+  hb->cksum = sum;
+
+  bwritev(to, log.lh.n+1, 1);  // write the log; the committer waits
+  for (tail = 0; tail < log.lh.n+1; tail++)
+    brelse(to[tail]);
+}
+
+// Add the blocks of the just-committed transaction to the
+// blocks waiting to be checkpointed. log_write() pinned each
+// one; a block that is already waiting keeps just one pin.
+static void
+add_ckpt(void)
+{
+  struct buf *b;
+  int i;
+
+  for (i = 0; i < log.lh.n; i++) {
+    b = log.buf[i];
+    if (b->ckpt) {
+      bunpin(b);
+    } else {
+      b->ckpt = 1;
+      log.ckpt[log.nckpt++] = b;
+    }
+  }
+}
+
+// Write the committed blocks home from the cache, in block
+// order, then free the whole log. Only called from commit(),
+// when no FS system call is executing, so the cached blocks
+// hold just committed changes.
+static void
+checkpoint(void)
+{
+  struct buf *dbuf[MAXBIOVEC], *t;
+  int i, j, n;
+
+  // insertion sort, so the disk sees ascending blocks.
+  for (i = 1; i < log.nckpt; i++) {
+    t = log.ckpt[i];
+    for (j = i; j > 0 && log.ckpt[j-1]->blockno > t->blockno; j--)
+      log.ckpt[j] = log.ckpt[j-1];
+    log.ckpt[j] = t;
   }
+
+  for (i = 0; i < log.nckpt; i += n) {
+    n = log.nckpt - i;
+    if (n > MAXBIOVEC)
+      n = MAXBIOVEC;
+    for (j = 0; j < n; j++)
+      dbuf[j] = bread(log.dev, log.ckpt[i+j]->blockno); // pinned, so cached
+    bwritev(dbuf, n, 0);  // write home
+    for (j = 0; j < n; j++) {
+      dbuf[j]->ckpt = 0;
+      bunpin(dbuf[j]);
+      brelse(dbuf[j]);
+    }
+  }
+  log.nckpt = 0;
+
+  // the log is now empty.
+  write_super(log.head, log.lh.seq);
+  log.used = 0;
 }
 
 static void
 commit()
 {
   if (log.lh.n > 0) {
-    write_log();     // Write modified blocks from cache to log
-    write_head();    // Write header to disk -- the real commit
-    install_trans(0); // Now install writes to home locations
+    write_log();     // Write header and modified blocks to log -- the real commit
+    log.head = (log.head + log.lh.n + 1) % log.size;
+    log.used += log.lh.n + 1;
+    add_ckpt();
     log.lh.n = 0;
-    write_head();    // Erase the transaction from the log
+    log.lh.seq++;
+
+    // checkpoint only if the next transaction might not fit.
+    if (log.used + log.txmax + 1 > log.size || log.nckpt + log.txmax > NCKPT)
+      checkpoint();
   }
 }
 
@@ -214,23 +468,23 @@ commit()
 void
 log_write(struct buf *b)
 {
-  int i;
+  // log absorption: if b is already in this transaction, there
+  // is nothing to do. b->logseq is safe to look at since the
+  // caller holds b's lock, and log.lh.seq is since no commit
+  // can start while the caller's transaction is outstanding.
+  if (b->logseq == log.lh.seq + 1)
+    return;
 
   acquire(&log.lock);
-  if (log.lh.n >= LOGSIZE || log.lh.n >= log.size - 1)
+  if (log.lh.n >= log.txmax)
     panic("too big a transaction");
   if (log.outstanding < 1)
     panic("log_write outside of trans");
 
-  for (i = 0; i < log.lh.n; i++) {
-    if (log.lh.block[i] == b->blockno)   // log absorption
-      break;
-  }
-  log.lh.block[i] = b->blockno;
-  if (i == log.lh.n) {  // Add new block to log?
-    bpin(b);
-    log.lh.n++;
-  }
+  log.lh.block[log.lh.n] = b->blockno;
+  log.buf[log.lh.n] = b;
+  log.lh.n++;
+  b->logseq = log.lh.seq + 1;
+  bpin(b);
   release(&log.lock);
 }
-
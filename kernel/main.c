@@ -21,12 +21,15 @@ main()
     kvminithart();   // turn on paging
     procinit();      // process table
     trapinit();      // trap vectors
+    hrtimerinit();   // nanosleep() timers
     trapinithart();  // install kernel trap vector
     plicinit();      // set up interrupt controller
     plicinithart();  // ask PLIC for device interrupts
     binit();         // buffer cache
+    blkinit();       // block I/O queue
     iinit();         // inode table
     fileinit();      // file table
+    epollinit();     // epoll items
     virtio_disk_init(); // emulated hard disk
     userinit();      // first user process
     __sync_synchronize();
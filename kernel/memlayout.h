@@ -29,6 +29,14 @@
 #define CLINT 0x2000000L
 #define CLINT_MTIMECMP(hartid) (CLINT + 0x4000 + 8*(hartid))
 #define CLINT_MTIME (CLINT + 0xBFF8) // cycles since boot.
+#define CLINT_FREQ 10000000L // mtime (and time CSR) rate in qemu, Hz
+
+// timer_scratch[hart][] entries shared by timervec
+// (kernelvec.S), timerinit() (start.c) and hrtimer.c.
+#define NSCRATCH 9
+#define SCRATCH_NEXT 6      // time of the next periodic interrupt
+#define SCRATCH_DEADLINE 7  // one-shot interrupt time, or -1
+#define SCRATCH_TICKS 8     // periodic interrupts so far
 
 // qemu puts platform-level interrupt controller (PLIC) here.
 #define PLIC 0x0c000000L
@@ -62,6 +70,21 @@
 //   fixed-size stack
 //   expandable heap
 //   ...
+//   USHARED (struct ushared, the same page in every process)
+//   USYSCALL (struct usyscall, p->usyscall)
 //   TRAPFRAME (p->trapframe, used by the trampoline)
 //   TRAMPOLINE (the same page as in the kernel)
 #define TRAPFRAME (TRAMPOLINE - PGSIZE)
+#define USYSCALL (TRAPFRAME - PGSIZE)
+#define USHARED (USYSCALL - PGSIZE)
+
+// read-only pages that let user code find out some
+// things without a system call; see user/ulib.c.
+struct usyscall {
+  int pid;          // process ID
+};
+
+struct ushared {
+  uint ticks;       // copy of ticks, updated by clockintr()
+  uint64 timefreq;  // rate of the time CSR, Hz
+};
@@ -2,12 +2,36 @@
 #define NCPU          8  // maximum number of CPUs
 #define NOFILE       16  // open files per process
 #define NFILE       100  // open files per system
-#define NINODE       50  // maximum number of active i-nodes
+#ifndef NINODE
+#define NINODE     1000  // maximum number of active/cached i-nodes
+#endif
+#define NDENTRY     200  // size of directory name lookup cache
 #define NDEV         10  // maximum major device number
 #define ROOTDEV       1  // device number of file system root disk
 #define MAXARG       32  // max exec arguments
-#define MAXOPBLOCKS  10  // max # of blocks any FS op writes
-#define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in on-disk log
-#define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
-#define FSSIZE       1000  // size of file system in blocks
+#define MAXOPBLOCKS  16  // max # of blocks any FS op writes
+#define LOGSIZE      (MAXOPBLOCKS*6)  // max data blocks in one log transaction
+#define NCKPT        (6*LOGSIZE)  // max logged blocks pinned until checkpoint
+#ifndef LOGBLOCKS
+// default size of the on-disk log, for mkfs. Writes of new
+// blocks hit the NCKPT pin limit when about NCKPT+LOGSIZE of
+// it is in use; the rest holds blocks logged again.
+#define LOGBLOCKS    (2*NCKPT)
+#endif
+#ifndef LOGDELAY
+#define LOGDELAY      0  // if nonzero, commit the log every LOGDELAY ticks, not every op
+#endif
+#define NREADAHEAD   16  // max blocks read ahead of a sequential reader
+#define NBUF         (NCKPT+2*LOGSIZE+MAXOPBLOCKS+2*NREADAHEAD)  // size of disk block cache
+#define MAXBIOVEC    32  // max blocks in one disk request
+#define BLKDEPTH      4  // max disk requests in flight per queue
+#define NVQ        NCPU  // max virtio disk queues
+#define BLKREADEXPIRE 10000  // microseconds a read waits before it goes first
+#ifndef BLKPOLL
+#define BLKPOLL       0  // if 1, every blk_rw() polls for completion
+#endif
+#define BLKPOLLTIME  50  // microseconds to poll before sleeping
+#define FSSIZE       100000  // size of file system in blocks
 #define MAXPATH      128   // maximum file path name
+#define NPIPEPAGE    16  // max pages in a pipe's buffer (a power of two)
+#define NEPITEM     200  // files watched by all epoll instances
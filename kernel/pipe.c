@@ -7,16 +7,38 @@
 #include "fs.h"
 #include "sleeplock.h"
 #include "file.h"
+#include "poll.h"
+#include "waitq.h"
 
-#define PIPESIZE 512
+#define min(a, b) ((a) < (b) ? (a) : (b))
 
+// A pipe's data lives in a ring buffer of whole pages,
+// one to start with; fcntl(F_SETPIPE_SZ) can grow it to
+// NPIPEPAGE pages. The number of pages is a power of two,
+// so that the byte counts nread and nwrite can wrap.
+//
+// To avoid needless wakeup()s, a sleeping reader is woken
+// only when there is data for it, and a sleeping writer
+// only once at least half the buffer is free.
+//
+// splice() moves data between a pipe and a file with one
+// copy, between the buffer cache and the pipe's pages. It
+// can't hold pi->lock while the file system reads or writes
+// the pages, so it marks the pipe busy for writing (wbusy)
+// or reading (rbusy), and others wait.
 struct pipe {
   struct spinlock lock;
-  char data[PIPESIZE];
+  char *buf[NPIPEPAGE]; // the data, a page at a time
+  uint size;      // bytes of buf in use
   uint nread;     // number of bytes read
   uint nwrite;    // number of bytes written
   int readopen;   // read fd is still open
   int writeopen;  // write fd is still open
+  int rwait;      // a reader is sleeping until there is data
+  int wwait;      // a writer is sleeping until there is space
+  int rbusy;      // splice() is copying data out of buf
+  int wbusy;      // splice() is copying data into buf
+  struct waitq wq; // poll() waiters
 };
 
 int
@@ -30,11 +52,16 @@ pipealloc(struct file **f0, struct file **f1)
     goto bad;
   if((pi = (struct pipe*)kalloc()) == 0)
     goto bad;
+  memset(pi, 0, sizeof(*pi));
+  if((pi->buf[0] = kalloc()) == 0)
+    goto bad;
+  pi->size = PGSIZE;
   pi->readopen = 1;
   pi->writeopen = 1;
   pi->nwrite = 0;
   pi->nread = 0;
   initlock(&pi->lock, "pipe");
+  initwaitq(&pi->wq, &pi->lock);
   (*f0)->type = FD_PIPE;
   (*f0)->readable = 1;
   (*f0)->writable = 0;
@@ -58,6 +85,8 @@ pipealloc(struct file **f0, struct file **f1)
 void
 pipeclose(struct pipe *pi, int writable)
 {
+  int i;
+
   acquire(&pi->lock);
   if(writable){
     pi->writeopen = 0;
@@ -66,17 +95,66 @@ pipeclose(struct pipe *pi, int writable)
     pi->readopen = 0;
     wakeup(&pi->nwrite);
   }
+  waitq_wake(&pi->wq);
   if(pi->readopen == 0 && pi->writeopen == 0){
     release(&pi->lock);
+    for(i = 0; i < pi->size/PGSIZE; i++)
+      kfree(pi->buf[i]);
     kfree((char*)pi);
   } else
     release(&pi->lock);
 }
 
+// Copy n bytes between user address addr and the pipe's
+// buffer, starting at byte count off, into the pipe if
+// in is set. Copies a piece at a time, since the buffer's
+// pages aren't contiguous and it wraps around. Returns
+// the number of bytes copied, less than n on failure.
+static uint
+pipecopy(struct pipe *pi, int in, uint off, uint64 addr, uint n)
+{
+  pagetable_t pagetable = myproc()->pagetable;
+  uint done, o, m;
+  char *p;
+
+  for(done = 0; done < n; done += m){
+    o = (off + done) % pi->size;
+    p = pi->buf[o/PGSIZE] + o%PGSIZE;
+    m = min(n - done, PGSIZE - o%PGSIZE);
+    if(in && copyin(pagetable, p, addr + done, m) == -1)
+      break;
+    if(!in && copyout(pagetable, addr + done, p, m) == -1)
+      break;
+  }
+  return done;
+}
+
+// Wake a reader sleeping for data. Caller holds pi->lock.
+static void
+wakereader(struct pipe *pi)
+{
+  if(pi->rwait && pi->nwrite != pi->nread){
+    pi->rwait = 0;
+    wakeup(&pi->nread);
+  }
+}
+
+// Wake a writer sleeping for space, if at least half the
+// buffer is free. Caller holds pi->lock.
+static void
+wakewriter(struct pipe *pi)
+{
+  if(pi->wwait && pi->size - (pi->nwrite - pi->nread) >= pi->size/2){
+    pi->wwait = 0;
+    wakeup(&pi->nwrite);
+  }
+}
+
 int
 pipewrite(struct pipe *pi, uint64 addr, int n)
 {
   int i = 0;
+  uint m, c;
   struct proc *pr = myproc();
 
   acquire(&pi->lock);
@@ -85,18 +163,23 @@ pipewrite(struct pipe *pi, uint64 addr, int n)
       release(&pi->lock);
       return -1;
     }
-    if(pi->nwrite == pi->nread + PIPESIZE){ //DOC: pipewrite-full
-      wakeup(&pi->nread);
+    if(pi->nwrite == pi->nread + pi->size || pi->wbusy){ //DOC: pipewrite-full
+      wakereader(pi);
+      waitq_wake(&pi->wq);
+      pi->wwait = 1;
       sleep(&pi->nwrite, &pi->lock);
     } else {
-      char ch;
-      if(copyin(pr->pagetable, &ch, addr + i, 1) == -1)
+      // copy as much as fits.
+      m = min(n - i, pi->size - (pi->nwrite - pi->nread));
+      c = pipecopy(pi, 1, pi->nwrite, addr + i, m);
+      pi->nwrite += c;
+      i += c;
+      if(c < m)
         break;
-      pi->data[pi->nwrite++ % PIPESIZE] = ch;
-      i++;
     }
   }
-  wakeup(&pi->nread);
+  wakereader(pi);
+  waitq_wake(&pi->wq);
   release(&pi->lock);
 
   return i;
@@ -105,26 +188,236 @@ pipewrite(struct pipe *pi, uint64 addr, int n)
 int
 piperead(struct pipe *pi, uint64 addr, int n)
 {
-  int i;
+  uint m;
   struct proc *pr = myproc();
-  char ch;
 
   acquire(&pi->lock);
-  while(pi->nread == pi->nwrite && pi->writeopen){  //DOC: pipe-empty
+  while((pi->nread == pi->nwrite && pi->writeopen) || pi->rbusy){  //DOC: pipe-empty
     if(pr->killed){
       release(&pi->lock);
       return -1;
     }
+    pi->rwait = 1;
     sleep(&pi->nread, &pi->lock); //DOC: piperead-sleep
   }
-  for(i = 0; i < n; i++){  //DOC: piperead-copy
-    if(pi->nread == pi->nwrite)
+  // copy what there is.
+  m = pi->nwrite - pi->nread;  //DOC: piperead-copy
+  if(n < 0)
+    m = 0;
+  else if(m > n)
+    m = n;
+  m = pipecopy(pi, 0, pi->nread, addr, m);
+  pi->nread += m;
+  wakewriter(pi);  //DOC: piperead-wakeup
+  waitq_wake(&pi->wq);
+  release(&pi->lock);
+  return m;
+}
+
+// Report the poll() events ready on pi; see filepoll().
+int
+pipepoll(struct pipe *pi, struct waiter *w)
+{
+  int ev = 0;
+
+  acquire(&pi->lock);
+  if(w)
+    waitq_add(&pi->wq, w);
+  if(pi->nwrite != pi->nread)
+    ev |= POLLIN;
+  if(!pi->writeopen)
+    ev |= POLLHUP;
+  if(pi->nwrite != pi->nread + pi->size)
+    ev |= POLLOUT;
+  if(!pi->readopen)
+    ev |= POLLERR;
+  release(&pi->lock);
+  return ev;
+}
+
+// Size of pi's buffer, for fcntl(F_GETPIPE_SZ).
+int
+pipesize(struct pipe *pi)
+{
+  int size;
+
+  acquire(&pi->lock);
+  size = pi->size;
+  release(&pi->lock);
+  return size;
+}
+
+// Resize pi's buffer to hold at least n bytes, for
+// fcntl(F_SETPIPE_SZ). Returns the new size, or -1 if
+// n is too big or too small for what's in the pipe.
+int
+pipesetsize(struct pipe *pi, int n)
+{
+  char *buf[NPIPEPAGE], *p;
+  uint np, oldnp, count, done, o, m;
+  int i;
+
+  if(n <= 0 || n > NPIPEPAGE*PGSIZE)
+    return -1;
+  for(np = 1; np*PGSIZE < n; np *= 2)
+    ;
+  for(i = 0; i < np; i++){
+    if((buf[i] = kalloc()) == 0){
+      while(--i >= 0)
+        kfree(buf[i]);
+      return -1;
+    }
+  }
+
+  acquire(&pi->lock);
+  while(pi->wbusy || pi->rbusy){
+    if(pi->wbusy){
+      pi->wwait = 1;
+      sleep(&pi->nwrite, &pi->lock);
+    } else {
+      pi->rwait = 1;
+      sleep(&pi->nread, &pi->lock);
+    }
+  }
+  count = pi->nwrite - pi->nread;
+  if(count > np*PGSIZE){
+    release(&pi->lock);
+    for(i = 0; i < np; i++)
+      kfree(buf[i]);
+    return -1;
+  }
+
+  // move the data to the start of the new buffer.
+  for(done = 0; done < count; done += m){
+    o = (pi->nread + done) % pi->size;
+    p = pi->buf[o/PGSIZE] + o%PGSIZE;
+    m = min(count - done, PGSIZE - o%PGSIZE);
+    m = min(m, PGSIZE - done%PGSIZE);
+    memmove(buf[done/PGSIZE] + done%PGSIZE, p, m);
+  }
+
+  // swap the buffers; buf[] gets the old pages.
+  oldnp = pi->size/PGSIZE;
+  for(i = 0; i < NPIPEPAGE; i++){
+    p = pi->buf[i];
+    pi->buf[i] = i < np ? buf[i] : 0;
+    buf[i] = i < oldnp ? p : 0;
+  }
+  pi->size = np*PGSIZE;
+  pi->nread = 0;
+  pi->nwrite = count;
+  wakewriter(pi);
+  waitq_wake(&pi->wq);
+  release(&pi->lock);
+
+  for(i = 0; i < oldnp; i++)
+    kfree(buf[i]);
+  return np*PGSIZE;
+}
+
+// Move up to n bytes from inode file f into pi, for splice().
+// Reads straight from the buffer cache into the pipe's pages.
+// Returns the number of bytes moved, 0 at end of file.
+int
+pipesplicein(struct pipe *pi, struct file *f, int n)
+{
+  int tot, r;
+  uint o, m;
+  char *p;
+  struct proc *pr = myproc();
+
+  tot = 0;
+  acquire(&pi->lock);
+  while(tot < n){
+    if(pi->readopen == 0 || pr->killed){
+      tot = tot ? tot : -1;
       break;
-    ch = pi->data[pi->nread++ % PIPESIZE];
-    if(copyout(pr->pagetable, addr + i, &ch, 1) == -1)
+    }
+    if(pi->nwrite == pi->nread + pi->size || pi->wbusy){
+      wakereader(pi);
+      waitq_wake(&pi->wq);
+      pi->wwait = 1;
+      sleep(&pi->nwrite, &pi->lock);
+      continue;
+    }
+    // the free space up to the end of its page.
+    o = pi->nwrite % pi->size;
+    p = pi->buf[o/PGSIZE] + o%PGSIZE;
+    m = min(n - tot, pi->size - (pi->nwrite - pi->nread));
+    m = min(m, PGSIZE - o%PGSIZE);
+    pi->wbusy = 1;
+    release(&pi->lock);
+
+    r = filereadi(f, 0, (uint64)p, m);
+
+    acquire(&pi->lock);
+    pi->wbusy = 0;
+    if(pi->wwait){
+      pi->wwait = 0;
+      wakeup(&pi->nwrite);
+    }
+    if(r < 0 && tot == 0)
+      tot = -1;
+    if(r <= 0)
       break;
+    pi->nwrite += r;
+    tot += r;
+    wakereader(pi);
+    if(r < m)
+      break;  // end of file
   }
-  wakeup(&pi->nwrite);  //DOC: piperead-wakeup
+  wakereader(pi);
+  waitq_wake(&pi->wq);
   release(&pi->lock);
-  return i;
+  return tot;
+}
+
+// Move up to n bytes from pi to inode file f, for splice().
+// Like piperead(), waits for data, then moves what there is,
+// writing it straight from the pipe's pages. Returns the
+// number of bytes moved, 0 if the pipe is empty and closed.
+int
+pipespliceout(struct pipe *pi, struct file *f, int n)
+{
+  int tot, r;
+  uint o, m;
+  char *p;
+  struct proc *pr = myproc();
+
+  acquire(&pi->lock);
+  while((pi->nread == pi->nwrite && pi->writeopen) || pi->rbusy){
+    if(pr->killed){
+      release(&pi->lock);
+      return -1;
+    }
+    pi->rwait = 1;
+    sleep(&pi->nread, &pi->lock);
+  }
+  for(tot = 0; tot < n && pi->nread != pi->nwrite; tot += r){
+    // the data up to the end of its page.
+    o = pi->nread % pi->size;
+    p = pi->buf[o/PGSIZE] + o%PGSIZE;
+    m = min(n - tot, pi->nwrite - pi->nread);
+    m = min(m, PGSIZE - o%PGSIZE);
+    pi->rbusy = 1;
+    release(&pi->lock);
+
+    r = filewritei(f, 0, (uint64)p, m);
+
+    acquire(&pi->lock);
+    pi->rbusy = 0;
+    if(pi->rwait){
+      pi->rwait = 0;
+      wakeup(&pi->nread);
+    }
+    if(r < 0){
+      tot = tot ? tot : -1;
+      break;
+    }
+    pi->nread += r;
+    wakewriter(pi);
+  }
+  waitq_wake(&pi->wq);
+  release(&pi->lock);
+  return tot;
 }
@@ -0,0 +1,162 @@
+// Waiting for several files at once.
+//
+// An object that poll() can watch (a pipe, the console)
+// keeps a waitq of waiters. When its state changes it calls
+// waitq_wake(), which calls each waiter's fn. Its poll
+// function (pipepoll(), consolepoll()) reports the events
+// that are ready now and, given a waiter, adds it to the
+// queue.
+//
+// poll() adds a waiter to each file it watches, whose fn
+// wakes it up, and sleeps until one fires or the timeout,
+// in clock ticks, runs out.
+
+#include "types.h"
+#include "param.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "proc.h"
+#include "fs.h"
+#include "file.h"
+#include "defs.h"
+#include "poll.h"
+#include "waitq.h"
+
+void
+initwaitq(struct waitq *wq, struct spinlock *lk)
+{
+  wq->lock = lk;
+  wq->head = 0;
+}
+
+// Add w, whose fn and arg are set, to wq.
+// Caller holds wq->lock.
+void
+waitq_add(struct waitq *wq, struct waiter *w)
+{
+  w->wq = wq;
+  w->next = wq->head;
+  wq->head = w;
+}
+
+// Take w off its queue, if it is on one.
+void
+waitq_del(struct waiter *w)
+{
+  struct waiter **pp;
+  struct waitq *wq = w->wq;
+
+  if(wq == 0)
+    return;
+  acquire(wq->lock);
+  for(pp = &wq->head; *pp; pp = &(*pp)->next){
+    if(*pp == w){
+      *pp = w->next;
+      break;
+    }
+  }
+  release(wq->lock);
+  w->wq = 0;
+}
+
+// The object's state has changed: call the waiters.
+// Caller holds wq->lock.
+void
+waitq_wake(struct waitq *wq)
+{
+  struct waiter *w;
+
+  for(w = wq->head; w; w = w->next)
+    w->fn(w);
+}
+
+// State of a poll() call.
+struct poller {
+  struct spinlock lock;
+  int fired;      // a waiter has been called since the last check
+};
+
+static void
+pollwake(struct waiter *w)
+{
+  struct poller *pl = w->arg;
+
+  acquire(&pl->lock);
+  pl->fired = 1;
+  wakeup(pl);
+  release(&pl->lock);
+}
+
+// Wait for an event on one of n files fds[], or for
+// timeout ticks (forever if timeout < 0). Returns the
+// number of files with events, 0 on timeout. Entries
+// with a negative fd are ignored.
+uint64
+sys_poll(void)
+{
+  struct pollfd pfd[NOFILE];
+  struct waiter w[NOFILE+1];
+  struct poller pl;
+  struct proc *p = myproc();
+  struct file *f;
+  uint64 addr;
+  uint ticks0;
+  int n, timeout, i, nready, ev;
+
+  if(argaddr(0, &addr) < 0 || argint(1, &n) < 0 || argint(2, &timeout) < 0)
+    return -1;
+  if(n < 0 || n > NOFILE)
+    return -1;
+  if(copyin(p->pagetable, (char*)pfd, addr, n*sizeof(pfd[0])) < 0)
+    return -1;
+
+  initlock(&pl.lock, "poll");
+  for(i = 0; i <= n; i++){
+    w[i].wq = 0;
+    w[i].fn = pollwake;
+    w[i].arg = &pl;
+  }
+  acquire(&tickslock);
+  ticks0 = ticks;
+  if(timeout > 0)
+    waitq_add(&tickswq, &w[n]);
+  release(&tickslock);
+
+  for(;;){
+    // events that happen from here on set pl.fired.
+    pl.fired = 0;
+    nready = 0;
+    for(i = 0; i < n; i++){
+      pfd[i].revents = 0;
+      if(pfd[i].fd < 0)
+        continue;  // slot switched off
+      if(pfd[i].fd >= NOFILE || (f = p->ofile[pfd[i].fd]) == 0){
+        pfd[i].revents = POLLNVAL;
+        nready++;
+        continue;
+      }
+      // the first time, start watching each file.
+      ev = filepoll(f, w[i].wq ? 0 : &w[i]);
+      pfd[i].revents = ev & (pfd[i].events | POLLERR | POLLHUP);
+      if(pfd[i].revents)
+        nready++;
+    }
+    if(nready > 0 || timeout == 0 || p->killed)
+      break;
+    if(timeout > 0 && ticks - ticks0 >= timeout)
+      break;
+    acquire(&pl.lock);
+    while(!pl.fired && !p->killed)
+      sleep(&pl, &pl.lock);
+    release(&pl.lock);
+  }
+
+  for(i = 0; i <= n; i++)
+    waitq_del(&w[i]);
+  if(p->killed)
+    return -1;
+  if(copyout(p->pagetable, addr, (char*)pfd, n*sizeof(pfd[0])) < 0)
+    return -1;
+  return nready;
+}
@@ -0,0 +1,13 @@
+// poll() system call interface.
+
+struct pollfd {
+  int fd;         // file descriptor to watch
+  short events;   // events of interest
+  short revents;  // events that happened, set by poll()
+};
+
+#define POLLIN   0x001  // there is data to read
+#define POLLOUT  0x004  // writing won't block
+#define POLLERR  0x008  // the other end of a pipe is closed (writers)
+#define POLLHUP  0x010  // the other end of a pipe is closed (readers)
+#define POLLNVAL 0x020  // fd is not open
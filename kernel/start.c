@@ -11,7 +11,7 @@ void timerinit();
 __attribute__ ((aligned (16))) char stack0[4096 * NCPU];
 
 // a scratch area per CPU for machine-mode timer interrupts.
-uint64 timer_scratch[NCPU][5];
+uint64 timer_scratch[NCPU][NSCRATCH];
 
 // assembly code in kernelvec.S for machine-mode timer interrupt.
 extern void timervec();
@@ -43,6 +43,10 @@ start()
   w_pmpaddr0(0x3fffffffffffffull);
   w_pmpcfg0(0xf);
 
+  // allow supervisor mode to read the time CSR,
+  // and to let user mode read it (see scounteren).
+  w_mcounteren(r_mcounteren() | 2);
+
   // ask for clock interrupts.
   timerinit();
 
@@ -69,12 +73,19 @@ timerinit()
   *(uint64*)CLINT_MTIMECMP(id) = *(uint64*)CLINT_MTIME + interval;
 
   // prepare information in scratch[] for timervec.
-  // scratch[0..2] : space for timervec to save registers.
-  // scratch[3] : address of CLINT MTIMECMP register.
-  // scratch[4] : desired interval (in cycles) between timer interrupts.
+  // scratch[0..3] : space for timervec to save registers.
+  // scratch[4] : address of CLINT MTIMECMP register.
+  // scratch[5] : desired interval (in cycles) between timer interrupts.
+  // scratch[SCRATCH_NEXT] : time of the next periodic interrupt.
+  // scratch[SCRATCH_DEADLINE] : one-shot interrupt time, or -1;
+  //   set by hrtimer.c, cleared by timervec once it passes.
+  // scratch[SCRATCH_TICKS] : count of periodic interrupts.
   uint64 *scratch = &timer_scratch[id][0];
-  scratch[3] = CLINT_MTIMECMP(id);
-  scratch[4] = interval;
+  scratch[4] = CLINT_MTIMECMP(id);
+  scratch[5] = interval;
+  scratch[SCRATCH_NEXT] = *(uint64*)CLINT_MTIMECMP(id);
+  scratch[SCRATCH_DEADLINE] = -1;
+  scratch[SCRATCH_TICKS] = 0;
   w_mscratch((uint64)scratch);
 
   // set the machine-mode trap handler.
@@ -0,0 +1,9 @@
+// File system summary, as returned by the statfs() system call.
+
+struct statfs {
+  uint size;     // size of file system image (blocks)
+  uint nblocks;  // number of data blocks
+  uint nfree;    // free blocks
+  uint ninodes;  // number of inodes
+  uint nlog;     // number of log blocks
+};
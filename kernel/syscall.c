@@ -6,6 +6,7 @@
 #include "proc.h"
 #include "syscall.h"
 #include "defs.h"
+#include "ioring.h"
 
 // Fetch the uint64 at addr from the current process.
 int
@@ -104,6 +105,19 @@ extern uint64 sys_unlink(void);
 extern uint64 sys_wait(void);
 extern uint64 sys_write(void);
 extern uint64 sys_uptime(void);
+extern uint64 sys_fsync(void);
+extern uint64 sys_sync(void);
+extern uint64 sys_blkstat(void);
+extern uint64 sys_statfs(void);
+extern uint64 sys_fcntl(void);
+extern uint64 sys_splice(void);
+extern uint64 sys_poll(void);
+extern uint64 sys_epoll_create(void);
+extern uint64 sys_epoll_ctl(void);
+extern uint64 sys_epoll_wait(void);
+extern uint64 sys_ioring_enter(void);
+extern uint64 sys_clock_gettime(void);
+extern uint64 sys_nanosleep(void);
 
 static uint64 (*syscalls[])(void) = {
 [SYS_fork]    sys_fork,
@@ -127,6 +141,19 @@ static uint64 (*syscalls[])(void) = {
 [SYS_link]    sys_link,
 [SYS_mkdir]   sys_mkdir,
 [SYS_close]   sys_close,
+[SYS_fsync]   sys_fsync,
+[SYS_sync]    sys_sync,
+[SYS_blkstat] sys_blkstat,
+[SYS_statfs]  sys_statfs,
+[SYS_fcntl]   sys_fcntl,
+[SYS_splice]  sys_splice,
+[SYS_poll]    sys_poll,
+[SYS_epoll_create] sys_epoll_create,
+[SYS_epoll_ctl]    sys_epoll_ctl,
+[SYS_epoll_wait]   sys_epoll_wait,
+[SYS_ioring_enter] sys_ioring_enter,
+[SYS_clock_gettime] sys_clock_gettime,
+[SYS_nanosleep]    sys_nanosleep,
 };
 
 void
@@ -144,3 +171,60 @@ syscall(void)
     p->trapframe->a0 = -1;
   }
 }
+
+// System calls that ioring_enter() will run.
+static char ioring_ok[NELEM(syscalls)] = {
+[SYS_read]  1,
+[SYS_write] 1,
+[SYS_open]  1,
+[SYS_close] 1,
+[SYS_fstat] 1,
+};
+
+// Run the batch of system calls submitted in the user
+// struct ioring at a0, one trap for the lot; see ioring.h.
+// Each call goes through syscalls[] with its arguments in
+// the trap frame, as if it had trapped itself. Returns the
+// number of calls run.
+uint64
+sys_ioring_enter(void)
+{
+  struct proc *p = myproc();
+  struct ioring *u;   // user address
+  struct io_sqe sqe;
+  struct io_cqe cqe;
+  uint idx[4];        // sqhead, sqtail, cqhead, cqtail
+  uint64 addr;
+  int n = 0;
+
+  if(argaddr(0, &addr) < 0)
+    return -1;
+  u = (struct ioring*)addr;
+  if(copyin(p->pagetable, (char*)idx, (uint64)&u->sqhead, sizeof(idx)) < 0)
+    return -1;
+  while(idx[0] != idx[1] && idx[3] - idx[2] < IORING_SIZE && !p->killed){
+    if(copyin(p->pagetable, (char*)&sqe, (uint64)&u->sq[idx[0] % IORING_SIZE],
+              sizeof(sqe)) < 0)
+      return -1;
+    cqe.data = sqe.data;
+    if(sqe.op > 0 && sqe.op < NELEM(syscalls) && ioring_ok[sqe.op]){
+      // the batch's own arguments are no longer needed.
+      p->trapframe->a0 = sqe.arg[0];
+      p->trapframe->a1 = sqe.arg[1];
+      p->trapframe->a2 = sqe.arg[2];
+      cqe.res = syscalls[sqe.op]();
+    } else {
+      cqe.res = -1;
+    }
+    if(copyout(p->pagetable, (uint64)&u->cq[idx[3] % IORING_SIZE],
+               (char*)&cqe, sizeof(cqe)) < 0)
+      return -1;
+    idx[0]++;
+    idx[3]++;
+    n++;
+  }
+  if(copyout(p->pagetable, (uint64)&u->sqhead, (char*)&idx[0], sizeof(idx[0])) < 0 ||
+     copyout(p->pagetable, (uint64)&u->cqtail, (char*)&idx[3], sizeof(idx[3])) < 0)
+    return -1;
+  return n;
+}
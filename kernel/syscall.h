@@ -20,3 +20,16 @@
 #define SYS_link   19
 #define SYS_mkdir  20
 #define SYS_close  21
+#define SYS_fsync  22
+#define SYS_sync   23
+#define SYS_blkstat 24
+#define SYS_statfs 25
+#define SYS_fcntl  26
+#define SYS_splice 27
+#define SYS_poll   28
+#define SYS_epoll_create 29
+#define SYS_epoll_ctl    30
+#define SYS_epoll_wait   31
+#define SYS_ioring_enter 32
+#define SYS_clock_gettime 33
+#define SYS_nanosleep    34
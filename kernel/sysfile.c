@@ -15,6 +15,9 @@
 #include "sleeplock.h"
 #include "file.h"
 #include "fcntl.h"
+#include "blkstat.h"
+#include "statfs.h"
+#include "epoll.h"
 
 // Fetch the nth word-sized system call argument as a file descriptor
 // and return both the descriptor and the corresponding struct file.
@@ -115,6 +118,153 @@ sys_fstat(void)
   return filestat(f, st);
 }
 
+// Wait until the writes to an open file are on disk.
+// The log commits every file's updates together, so this
+// is sync() for files and directories.
+uint64
+sys_fsync(void)
+{
+  struct file *f;
+
+  if(argfd(0, 0, &f) < 0)
+    return -1;
+  if(f->type != FD_INODE)
+    return -1;
+  log_sync();
+  return 0;
+}
+
+// Control an open file. So far only pipes' buffer
+// sizes can be looked at and changed.
+uint64
+sys_fcntl(void)
+{
+  struct file *f;
+  int cmd, arg;
+
+  if(argfd(0, 0, &f) < 0 || argint(1, &cmd) < 0 || argint(2, &arg) < 0)
+    return -1;
+  if(f->type != FD_PIPE)
+    return -1;
+  switch(cmd){
+  case F_GETPIPE_SZ:
+    return pipesize(f->pipe);
+  case F_SETPIPE_SZ:
+    return pipesetsize(f->pipe, arg);
+  }
+  return -1;
+}
+
+// Move up to n bytes from fd in to fd out inside the kernel,
+// without copying them through user memory. One of them
+// must be a pipe and the other a file.
+uint64
+sys_splice(void)
+{
+  struct file *in, *out;
+  int n;
+
+  if(argfd(0, 0, &in) < 0 || argfd(1, 0, &out) < 0 || argint(2, &n) < 0)
+    return -1;
+  if(in->readable == 0 || out->writable == 0 || n < 0)
+    return -1;
+  if(in->type == FD_INODE && out->type == FD_PIPE)
+    return pipesplicein(out->pipe, in, n);
+  if(in->type == FD_PIPE && out->type == FD_INODE)
+    return pipespliceout(in->pipe, out, n);
+  return -1;
+}
+
+uint64
+sys_epoll_create(void)
+{
+  struct file *f;
+  int fd;
+
+  if(epollalloc(&f) < 0)
+    return -1;
+  if((fd = fdalloc(f)) < 0){
+    fileclose(f);
+    return -1;
+  }
+  return fd;
+}
+
+// Add, change or remove epoll instance epfd's watch on fd.
+// ev, a user struct epoll_event *, holds the events of
+// interest for add and change.
+uint64
+sys_epoll_ctl(void)
+{
+  struct file *ef, *f;
+  struct epoll_event ev;
+  int op;
+  uint64 addr;
+
+  if(argfd(0, 0, &ef) < 0 || argint(1, &op) < 0 || argfd(2, 0, &f) < 0 ||
+     argaddr(3, &addr) < 0)
+    return -1;
+  if(ef->type != FD_EPOLL)
+    return -1;
+  if(op != EPOLL_CTL_DEL &&
+     copyin(myproc()->pagetable, (char*)&ev, addr, sizeof(ev)) < 0)
+    return -1;
+  return epollctl(ef->epoll, op, f, &ev);
+}
+
+uint64
+sys_epoll_wait(void)
+{
+  struct file *ef;
+  uint64 addr;
+  int max, timeout;
+
+  if(argfd(0, 0, &ef) < 0 || argaddr(1, &addr) < 0 || argint(2, &max) < 0 ||
+     argint(3, &timeout) < 0)
+    return -1;
+  if(ef->type != FD_EPOLL)
+    return -1;
+  return epollwait(ef->epoll, addr, max, timeout);
+}
+
+// Wait until all file system writes are on disk.
+uint64
+sys_sync(void)
+{
+  log_sync();
+  return 0;
+}
+
+// Copy the block I/O statistics to user struct blkstat *st.
+uint64
+sys_blkstat(void)
+{
+  uint64 st;
+  struct blkstat bs;
+
+  if(argaddr(0, &st) < 0)
+    return -1;
+  blk_stat(&bs);
+  if(copyout(myproc()->pagetable, st, (char*)&bs, sizeof(bs)) < 0)
+    return -1;
+  return 0;
+}
+
+// Copy the file system summary to user struct statfs *st.
+uint64
+sys_statfs(void)
+{
+  uint64 st;
+  struct statfs fs;
+
+  if(argaddr(0, &st) < 0)
+    return -1;
+  fsstat(&fs);
+  if(copyout(myproc()->pagetable, st, (char*)&fs, sizeof(fs)) < 0)
+    return -1;
+  return 0;
+}
+
 // Create the path new as a link to the same inode as old.
 uint64
 sys_link(void)
@@ -172,10 +322,12 @@ isdirempty(struct inode *dp)
   int off;
   struct dirent de;
 
-  for(off=2*sizeof(de); off<dp->size; off+=sizeof(de)){
+  // "." and ".." need not be the first two entries
+  // of a hashed directory.
+  for(off=0; off<dp->size; off+=sizeof(de)){
     if(readi(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
       panic("isdirempty: readi");
-    if(de.inum != 0)
+    if(de.inum != 0 && namecmp(de.name, ".") != 0 && namecmp(de.name, "..") != 0)
       return 0;
   }
   return 1;
@@ -218,6 +370,7 @@ sys_unlink(void)
   memset(&de, 0, sizeof(de));
   if(writei(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
     panic("unlink: writei");
+  dcache_forget(dp, name);
   if(ip->type == T_DIR){
     dp->nlink--;
     iupdate(dp);
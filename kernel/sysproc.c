@@ -83,6 +83,31 @@ sys_kill(void)
   return kill(pid);
 }
 
+// Copy the time since boot, in nanoseconds, to the user
+// uint64 at a0.
+uint64
+sys_clock_gettime(void)
+{
+  uint64 addr, ns;
+
+  if(argaddr(0, &addr) < 0)
+    return -1;
+  ns = nsnow();
+  if(copyout(myproc()->pagetable, addr, (char*)&ns, sizeof(ns)) < 0)
+    return -1;
+  return 0;
+}
+
+uint64
+sys_nanosleep(void)
+{
+  uint64 ns;
+
+  if(argaddr(0, &ns) < 0)
+    return -1;
+  return nanosleep(ns);
+}
+
 // return how many clock tick interrupts have occurred
 // since start.
 uint64
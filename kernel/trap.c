@@ -5,9 +5,12 @@
 #include "spinlock.h"
 #include "proc.h"
 #include "defs.h"
+#include "waitq.h"
 
 struct spinlock tickslock;
 uint ticks;
+struct waitq tickswq;  // poll() timeouts
+struct ushared *ushared;  // page at USHARED in every process
 
 extern char trampoline[], uservec[], userret[];
 
@@ -20,6 +23,11 @@ void
 trapinit(void)
 {
   initlock(&tickslock, "time");
+  initwaitq(&tickswq, &tickslock);
+  if((ushared = (struct ushared*)kalloc()) == 0)
+    panic("trapinit");
+  memset(ushared, 0, PGSIZE);
+  ushared->timefreq = CLINT_FREQ;
 }
 
 // set up to take exceptions and traps while in the kernel.
@@ -27,6 +35,9 @@ void
 trapinithart(void)
 {
   w_stvec((uint64)kernelvec);
+
+  // let user code read the time CSR.
+  w_scounteren(r_scounteren() | 2);
 }
 
 //
@@ -164,7 +175,9 @@ clockintr()
 {
   acquire(&tickslock);
   ticks++;
+  ushared->ticks = ticks;
   wakeup(&ticks);
+  waitq_wake(&tickswq);
   release(&tickslock);
 }
 
@@ -177,6 +190,7 @@ int
 devintr()
 {
   uint64 scause = r_scause();
+  int n;
 
   if((scause & 0x8000000000000000L) &&
      (scause & 0xff) == 9){
@@ -202,16 +216,21 @@ devintr()
     return 1;
   } else if(scause == 0x8000000000000001L){
     // software interrupt from a machine-mode timer interrupt,
-    // forwarded by timervec in kernelvec.S.
+    // forwarded by timervec in kernelvec.S: a periodic tick,
+    // a nanosleep() deadline, or both.
 
-    if(cpuid() == 0){
-      clockintr();
-    }
-    
     // acknowledge the software interrupt by clearing
     // the SSIP bit in sip.
     w_sip(r_sip() & ~2);
 
+    n = hrtimerintr();
+    if(n == 0)
+      return 1;
+    if(cpuid() == 0){
+      while(n-- > 0)
+        clockintr();
+    }
+
     return 2;
   } else {
     return 0;
@@ -20,7 +20,11 @@
 // the address of virtio mmio register r.
 #define R(r) ((volatile uint32 *)(VIRTIO0 + (r)))
 
-static struct disk {
+// with VIRTIO_BLK_F_MQ the device can have several virtqueues,
+// each with its own descriptors and rings. we use one per CPU,
+// each with its own lock, so that harts submitting disk
+// requests at the same time need not share anything.
+struct vq {
   // the virtio driver and device mostly communicate through a set of
   // structures in RAM. pages[] allocates that memory. pages[] is a
   // global (instead of calls to kalloc()) because it must consist of
@@ -56,6 +60,8 @@ static struct disk {
   // our own book-keeping.
   char free[NUM];  // is a descriptor free?
   uint16 used_idx; // we've looked this far in used[2..NUM].
+  uint16 kick_idx; // avail->idx when we last decided whether to notify.
+  uint64 nkick;    // notifications sent to the device.
 
   // track info about in-flight operations,
   // for use when completion interrupt arrives.
@@ -69,17 +75,22 @@ static struct disk {
   // one-for-one with descriptors, for convenience.
   struct virtio_blk_req ops[NUM];
   
-  struct spinlock vdisk_lock;
+  struct spinlock lock;
   
-} __attribute__ ((aligned (PGSIZE))) disk;
+} __attribute__ ((aligned (PGSIZE)));
+
+static struct disk {
+  struct vq q[NVQ];
+  int nq;          // number of queues in use.
+  int event_idx;   // VIRTIO_RING_F_EVENT_IDX negotiated?
+  uint64 nintr;    // interrupts taken.
+} disk;
 
 void
 virtio_disk_init(void)
 {
   uint32 status = 0;
 
-  initlock(&disk.vdisk_lock, "virtio_disk");
-
   if(*R(VIRTIO_MMIO_MAGIC_VALUE) != 0x74726976 ||
      *R(VIRTIO_MMIO_VERSION) != 1 ||
      *R(VIRTIO_MMIO_DEVICE_ID) != 2 ||
@@ -98,55 +109,91 @@ virtio_disk_init(void)
   features &= ~(1 << VIRTIO_BLK_F_RO);
   features &= ~(1 << VIRTIO_BLK_F_SCSI);
   features &= ~(1 << VIRTIO_BLK_F_CONFIG_WCE);
-  features &= ~(1 << VIRTIO_BLK_F_MQ);
   features &= ~(1 << VIRTIO_F_ANY_LAYOUT);
-  features &= ~(1 << VIRTIO_RING_F_EVENT_IDX);
   features &= ~(1 << VIRTIO_RING_F_INDIRECT_DESC);
   *R(VIRTIO_MMIO_DRIVER_FEATURES) = features;
+  disk.event_idx = (features & (1 << VIRTIO_RING_F_EVENT_IDX)) != 0;
+
+  // with VIRTIO_BLK_F_MQ, the device config says how many
+  // queues there are; use up to one per CPU.
+  disk.nq = 1;
+  if(features & (1 << VIRTIO_BLK_F_MQ)){
+    disk.nq = *(volatile uint16 *)(VIRTIO0 + VIRTIO_MMIO_CONFIG + VIRTIO_BLK_CONFIG_NUM_QUEUES);
+    if(disk.nq > NVQ)
+      disk.nq = NVQ;
+    if(disk.nq < 1)
+      disk.nq = 1;
+  }
 
   // tell device that feature negotiation is complete.
   status |= VIRTIO_CONFIG_S_FEATURES_OK;
   *R(VIRTIO_MMIO_STATUS) = status;
 
+  *R(VIRTIO_MMIO_GUEST_PAGE_SIZE) = PGSIZE;
+
+  for(int qi = 0; qi < disk.nq; qi++){
+    struct vq *q = &disk.q[qi];
+
+    initlock(&q->lock, "virtio_disk");
+
+    // initialize queue qi.
+    *R(VIRTIO_MMIO_QUEUE_SEL) = qi;
+    uint32 max = *R(VIRTIO_MMIO_QUEUE_NUM_MAX);
+    if(max == 0)
+      panic("virtio disk has no queue");
+    if(max < NUM)
+      panic("virtio disk max queue too short");
+    *R(VIRTIO_MMIO_QUEUE_NUM) = NUM;
+    memset(q->pages, 0, sizeof(q->pages));
+    *R(VIRTIO_MMIO_QUEUE_PFN) = ((uint64)q->pages) >> PGSHIFT;
+
+    // desc = pages -- num * virtq_desc
+    // avail = pages + 0x40 -- 2 * uint16, then num * uint16
+    // used = pages + 4096 -- 2 * uint16, then num * vRingUsedElem
+
+    q->desc = (struct virtq_desc *) q->pages;
+    q->avail = (struct virtq_avail *)(q->pages + NUM*sizeof(struct virtq_desc));
+    q->used = (struct virtq_used *) (q->pages + PGSIZE);
+
+    // all NUM descriptors start out unused.
+    for(int i = 0; i < NUM; i++)
+      q->free[i] = 1;
+  }
+
   // tell device we're completely ready.
   status |= VIRTIO_CONFIG_S_DRIVER_OK;
   *R(VIRTIO_MMIO_STATUS) = status;
 
-  *R(VIRTIO_MMIO_GUEST_PAGE_SIZE) = PGSIZE;
+  // plic.c and trap.c arrange for interrupts from VIRTIO0_IRQ.
+}
 
-  // initialize queue 0.
-  *R(VIRTIO_MMIO_QUEUE_SEL) = 0;
-  uint32 max = *R(VIRTIO_MMIO_QUEUE_NUM_MAX);
-  if(max == 0)
-    panic("virtio disk has no queue 0");
-  if(max < NUM)
-    panic("virtio disk max queue too short");
-  *R(VIRTIO_MMIO_QUEUE_NUM) = NUM;
-  memset(disk.pages, 0, sizeof(disk.pages));
-  *R(VIRTIO_MMIO_QUEUE_PFN) = ((uint64)disk.pages) >> PGSHIFT;
-
-  // desc = pages -- num * virtq_desc
-  // avail = pages + 0x40 -- 2 * uint16, then num * uint16
-  // used = pages + 4096 -- 2 * uint16, then num * vRingUsedElem
-
-  disk.desc = (struct virtq_desc *) disk.pages;
-  disk.avail = (struct virtq_avail *)(disk.pages + NUM*sizeof(struct virtq_desc));
-  disk.used = (struct virtq_used *) (disk.pages + PGSIZE);
-
-  // all NUM descriptors start out unused.
-  for(int i = 0; i < NUM; i++)
-    disk.free[i] = 1;
+// number of queues, for the block layer.
+int
+virtio_disk_nqueue(void)
+{
+  return disk.nq;
+}
 
-  // plic.c and trap.c arrange for interrupts from VIRTIO0_IRQ.
+// copy out the notification and interrupt counts.
+void
+virtio_disk_stat(uint64 *nkick, uint64 *nintr)
+{
+  *nkick = 0;
+  for(int qi = 0; qi < disk.nq; qi++){
+    acquire(&disk.q[qi].lock);
+    *nkick += disk.q[qi].nkick;
+    release(&disk.q[qi].lock);
+  }
+  *nintr = __atomic_load_n(&disk.nintr, __ATOMIC_RELAXED);
 }
 
 // find a free descriptor, mark it non-free, return its index.
 static int
-alloc_desc()
+alloc_desc(struct vq *q)
 {
   for(int i = 0; i < NUM; i++){
-    if(disk.free[i]){
-      disk.free[i] = 0;
+    if(q->free[i]){
+      q->free[i] = 0;
       return i;
     }
   }
@@ -155,28 +202,27 @@ alloc_desc()
 
 // mark a descriptor as free.
 static void
-free_desc(int i)
+free_desc(struct vq *q, int i)
 {
   if(i >= NUM)
     panic("free_desc 1");
-  if(disk.free[i])
+  if(q->free[i])
     panic("free_desc 2");
-  disk.desc[i].addr = 0;
-  disk.desc[i].len = 0;
-  disk.desc[i].flags = 0;
-  disk.desc[i].next = 0;
-  disk.free[i] = 1;
-  wakeup(&disk.free[0]);
+  q->desc[i].addr = 0;
+  q->desc[i].len = 0;
+  q->desc[i].flags = 0;
+  q->desc[i].next = 0;
+  q->free[i] = 1;
 }
 
 // free a chain of descriptors.
 static void
-free_chain(int i)
+free_chain(struct vq *q, int i)
 {
   while(1){
-    int flag = disk.desc[i].flags;
-    int nxt = disk.desc[i].next;
-    free_desc(i);
+    int flag = q->desc[i].flags;
+    int nxt = q->desc[i].next;
+    free_desc(q, i);
     if(flag & VRING_DESC_F_NEXT)
       i = nxt;
     else
@@ -184,46 +230,55 @@ free_chain(int i)
   }
 }
 
-// allocate three descriptors (they need not be contiguous).
-// disk transfers always use three descriptors.
+// allocate n descriptors (they need not be contiguous).
+// a disk transfer of k blocks uses k+2 descriptors.
 static int
-alloc3_desc(int *idx)
+alloc_descs(struct vq *q, int *idx, int n)
 {
-  for(int i = 0; i < 3; i++){
-    idx[i] = alloc_desc();
+  for(int i = 0; i < n; i++){
+    idx[i] = alloc_desc(q);
     if(idx[i] < 0){
       for(int j = 0; j < i; j++)
-        free_desc(idx[j]);
+        free_desc(q, idx[j]);
       return -1;
     }
   }
   return 0;
 }
 
-void
-virtio_disk_rw(struct buf *b, int write)
+// start a request on queue qi for the n bufs linked from b
+// through b->qnext, which hold consecutive blocks.
+// virtio_disk_intr() calls blk_done(b) when it finishes.
+// returns -1, and does nothing, if there are not enough
+// free descriptors.
+int
+virtio_disk_submit(int qi, struct buf *b, int n, int write)
 {
+  struct vq *q = &disk.q[qi];
   uint64 sector = b->blockno * (BSIZE / 512);
+  int idx[MAXBIOVEC+2];
+  struct buf *bi;
+  int i;
+
+  if(qi < 0 || qi >= disk.nq || n < 1 || n > MAXBIOVEC || n+2 > NUM)
+    panic("virtio_disk_submit");
 
-  acquire(&disk.vdisk_lock);
+  acquire(&q->lock);
 
   // the spec's Section 5.2 says that legacy block operations use
-  // three descriptors: one for type/reserved/sector, one for the
-  // data, one for a 1-byte status result.
+  // a descriptor for type/reserved/sector, then descriptors for the
+  // data, then one for a 1-byte status result.
 
-  // allocate the three descriptors.
-  int idx[3];
-  while(1){
-    if(alloc3_desc(idx) == 0) {
-      break;
-    }
-    sleep(&disk.free[0], &disk.vdisk_lock);
+  // allocate the descriptors.
+  if(alloc_descs(q, idx, n+2) < 0){
+    release(&q->lock);
+    return -1;
   }
 
-  // format the three descriptors.
+  // format the descriptors.
   // qemu's virtio-blk.c reads them.
 
-  struct virtio_blk_req *buf0 = &disk.ops[idx[0]];
+  struct virtio_blk_req *buf0 = &q->ops[idx[0]];
 
   if(write)
     buf0->type = VIRTIO_BLK_T_OUT; // write the disk
@@ -232,84 +287,166 @@ virtio_disk_rw(struct buf *b, int write)
   buf0->reserved = 0;
   buf0->sector = sector;
 
-  disk.desc[idx[0]].addr = (uint64) buf0;
-  disk.desc[idx[0]].len = sizeof(struct virtio_blk_req);
-  disk.desc[idx[0]].flags = VRING_DESC_F_NEXT;
-  disk.desc[idx[0]].next = idx[1];
-
-  disk.desc[idx[1]].addr = (uint64) b->data;
-  disk.desc[idx[1]].len = BSIZE;
-  if(write)
-    disk.desc[idx[1]].flags = 0; // device reads b->data
-  else
-    disk.desc[idx[1]].flags = VRING_DESC_F_WRITE; // device writes b->data
-  disk.desc[idx[1]].flags |= VRING_DESC_F_NEXT;
-  disk.desc[idx[1]].next = idx[2];
+  q->desc[idx[0]].addr = (uint64) buf0;
+  q->desc[idx[0]].len = sizeof(struct virtio_blk_req);
+  q->desc[idx[0]].flags = VRING_DESC_F_NEXT;
+  q->desc[idx[0]].next = idx[1];
+
+  // one data descriptor per buf.
+  for(i = 1, bi = b; i <= n; i++, bi = bi->qnext){
+    q->desc[idx[i]].addr = (uint64) bi->data;
+    q->desc[idx[i]].len = BSIZE;
+    if(write)
+      q->desc[idx[i]].flags = 0; // device reads b->data
+    else
+      q->desc[idx[i]].flags = VRING_DESC_F_WRITE; // device writes b->data
+    q->desc[idx[i]].flags |= VRING_DESC_F_NEXT;
+    q->desc[idx[i]].next = idx[i+1];
+  }
 
-  disk.info[idx[0]].status = 0xff; // device writes 0 on success
-  disk.desc[idx[2]].addr = (uint64) &disk.info[idx[0]].status;
-  disk.desc[idx[2]].len = 1;
-  disk.desc[idx[2]].flags = VRING_DESC_F_WRITE; // device writes the status
-  disk.desc[idx[2]].next = 0;
+  q->info[idx[0]].status = 0xff; // device writes 0 on success
+  q->desc[idx[n+1]].addr = (uint64) &q->info[idx[0]].status;
+  q->desc[idx[n+1]].len = 1;
+  q->desc[idx[n+1]].flags = VRING_DESC_F_WRITE; // device writes the status
+  q->desc[idx[n+1]].next = 0;
 
   // record struct buf for virtio_disk_intr().
-  b->disk = 1;
-  disk.info[idx[0]].b = b;
+  q->info[idx[0]].b = b;
 
   // tell the device the first index in our chain of descriptors.
-  disk.avail->ring[disk.avail->idx % NUM] = idx[0];
+  q->avail->ring[q->avail->idx % NUM] = idx[0];
 
   __sync_synchronize();
 
   // tell the device another avail ring entry is available.
-  disk.avail->idx += 1; // not % NUM ...
+  // virtio_disk_kick() lets it know to look.
+  q->avail->idx += 1; // not % NUM ...
+
+  release(&q->lock);
+  return 0;
+}
+
+// with EVENT_IDX, has idx moved past event since it was old?
+// (the spec's vring_need_event().)
+static int
+need_event(uint16 event, uint16 idx, uint16 old)
+{
+  return (uint16)(idx - event - 1) < (uint16)(idx - old);
+}
 
+// tell the device about requests added to queue qi by
+// virtio_disk_submit() since the last call. with EVENT_IDX,
+// the device says (in used->avail_event) how far through the
+// avail ring it will look anyway, and the notification, a
+// costly exit from the VM, is only sent if the new requests
+// are past that point.
+void
+virtio_disk_kick(int qi)
+{
+  struct vq *q = &disk.q[qi];
+  uint16 old, idx;
+
+  acquire(&q->lock);
   __sync_synchronize();
+  old = q->kick_idx;
+  idx = q->avail->idx;
+  q->kick_idx = idx;
+  if(idx != old &&
+     (!disk.event_idx || need_event(q->used->avail_event, idx, old))){
+    *R(VIRTIO_MMIO_QUEUE_NOTIFY) = qi; // value is queue number
+    q->nkick++;
+  }
+  release(&q->lock);
+}
+
+// collect the requests the device has finished on q into
+// done[], freeing their descriptors. returns how many.
+// caller holds q->lock.
+static int
+drain(struct vq *q, struct buf **done)
+{
+  int ndone = 0;
+
+  // the device increments q->used->idx when it
+  // adds an entry to the used ring.
+
+  while(1){
+    while(q->used_idx != q->used->idx){
+      __sync_synchronize();
+      int id = q->used->ring[q->used_idx % NUM].id;
 
-  *R(VIRTIO_MMIO_QUEUE_NOTIFY) = 0; // value is queue number
+      if(q->info[id].status != 0)
+        panic("virtio_disk_intr status");
 
-  // Wait for virtio_disk_intr() to say request has finished.
-  while(b->disk == 1) {
-    sleep(b, &disk.vdisk_lock);
+      done[ndone++] = q->info[id].b;
+      q->info[id].b = 0;
+      free_chain(q, id);
+
+      q->used_idx += 1;
+    }
+    if(!disk.event_idx)
+      break;
+
+    // with EVENT_IDX, the device interrupts only when used->idx
+    // moves past used_event, so completions that arrive while
+    // we drain the ring raise no further interrupts. ask for
+    // one at the next completion, then look once more in case
+    // it arrived before the device saw the request.
+    q->avail->used_event = q->used_idx;
+    __sync_synchronize();
+    if(q->used_idx == q->used->idx)
+      break;
   }
+  return ndone;
+}
+
+// finish any requests the device has completed on queue qi.
+static void
+reap(int qi)
+{
+  struct vq *q = &disk.q[qi];
+  struct buf *done[NUM];
+  int ndone;
+
+  if(*(volatile uint16 *)&q->used->idx == q->used_idx)
+    return;
 
-  disk.info[idx[0]].b = 0;
-  free_chain(idx[0]);
+  acquire(&q->lock);
+  ndone = drain(q, done);
+  release(&q->lock);
 
-  release(&disk.vdisk_lock);
+  // tell the block layer without holding q->lock, since
+  // it calls virtio_disk_submit() with its own lock held.
+  for(int i = 0; i < ndone; i++)
+    blk_done(done[i]);
 }
 
+// finish any requests the device has completed on queue qi,
+// without waiting for its interrupt. for blk_rw()'s polling.
 void
-virtio_disk_intr()
+virtio_disk_poll(int qi)
 {
-  acquire(&disk.vdisk_lock);
+  reap(qi);
+}
 
+void
+virtio_disk_intr()
+{
   // the device won't raise another interrupt until we tell it
   // we've seen this interrupt, which the following line does.
   // this may race with the device writing new entries to
-  // the "used" ring, in which case we may process the new
+  // the "used" rings, in which case we may process the new
   // completion entries in this interrupt, and have nothing to do
   // in the next interrupt, which is harmless.
   *R(VIRTIO_MMIO_INTERRUPT_ACK) = *R(VIRTIO_MMIO_INTERRUPT_STATUS) & 0x3;
 
   __sync_synchronize();
 
-  // the device increments disk.used->idx when it
-  // adds an entry to the used ring.
-
-  while(disk.used_idx != disk.used->idx){
-    __sync_synchronize();
-    int id = disk.used->ring[disk.used_idx % NUM].id;
-
-    if(disk.info[id].status != 0)
-      panic("virtio_disk_intr status");
-
-    struct buf *b = disk.info[id].b;
-    b->disk = 0;   // disk is done with buf
-    wakeup(b);
-
-    disk.used_idx += 1;
-  }
+  __atomic_fetch_add(&disk.nintr, 1, __ATOMIC_RELAXED);
 
-  release(&disk.vdisk_lock);
+  // the mmio transport has one interrupt for all queues,
+  // so look at each; reap() takes each queue's lock only
+  // if it has completions.
+  for(int qi = 0; qi < disk.nq; qi++)
+    reap(qi);
 }
@@ -0,0 +1,14 @@
+// A queue of callbacks waiting for an object (a pipe, the
+// console, the clock) to change state; see poll.c.
+// The object's lock protects the queue.
+struct waitq {
+  struct spinlock *lock;  // the object's lock
+  struct waiter *head;
+};
+
+struct waiter {
+  struct waiter *next;
+  struct waitq *wq;                // the queue it is on, if any
+  void (*fn)(struct waiter*);      // called, under wq->lock, on a change
+  void *arg;
+};
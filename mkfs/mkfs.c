@@ -15,14 +15,14 @@
 #define static_assert(a, b) do { switch (0) case 0: case (a): ; } while (0)
 #endif
 
-#define NINODES 200
+#define NINODES 2000
 
 // Disk layout:
 // [ boot block | sb block | log | inode blocks | free bit map | data blocks ]
 
 int nbitmap = FSSIZE/(BSIZE*8) + 1;
 int ninodeblocks = NINODES / IPB + 1;
-int nlog = LOGSIZE;
+int nlog = LOGBLOCKS;
 int nmeta;    // Number of meta blocks (boot, sb, nlog, inode, bitmap)
 int nblocks;  // Number of data blocks
 
@@ -32,6 +32,9 @@ char zeroes[BSIZE];
 uint freeinode = 1;
 uint freeblock;
 
+struct dirent rootents[NINODES];
+int nrootents;
+
 
 void balloc(int);
 void wsect(uint, void*);
@@ -40,6 +43,7 @@ void rinode(uint inum, struct dinode *ip);
 void rsect(uint sec, void *buf);
 uint ialloc(ushort type);
 void iappend(uint inum, void *p, int n);
+void dirappend(uint inum, struct dirent *ents, int n);
 void die(const char *);
 
 // convert to intel byte order
@@ -69,16 +73,25 @@ int
 main(int argc, char *argv[])
 {
   int i, cc, fd;
-  uint rootino, inum, off;
-  struct dirent de;
+  uint rootino, inum;
   char buf[BSIZE];
-  struct dinode din;
 
 
   static_assert(sizeof(int) == 4, "Integers must be 4 bytes!");
 
+  // -l n makes a log of n blocks.
+  if(argc > 2 && strcmp(argv[1], "-l") == 0){
+    nlog = atoi(argv[2]);
+    argc -= 2;
+    argv += 2;
+  }
+
   if(argc < 2){
-    fprintf(stderr, "Usage: mkfs fs.img files...\n");
+    fprintf(stderr, "Usage: mkfs [-l logblocks] fs.img files...\n");
+    exit(1);
+  }
+  if(nlog < MAXOPBLOCKS+2 || nlog > FSSIZE/2){
+    fprintf(stderr, "mkfs: bad log size %d\n", nlog);
     exit(1);
   }
 
@@ -117,15 +130,10 @@ main(int argc, char *argv[])
   rootino = ialloc(T_DIR);
   assert(rootino == ROOTINO);
 
-  bzero(&de, sizeof(de));
-  de.inum = xshort(rootino);
-  strcpy(de.name, ".");
-  iappend(rootino, &de, sizeof(de));
-
-  bzero(&de, sizeof(de));
-  de.inum = xshort(rootino);
-  strcpy(de.name, "..");
-  iappend(rootino, &de, sizeof(de));
+  rootents[nrootents].inum = xshort(rootino);
+  strcpy(rootents[nrootents++].name, ".");
+  rootents[nrootents].inum = xshort(rootino);
+  strcpy(rootents[nrootents++].name, "..");
 
   for(i = 2; i < argc; i++){
     // get rid of "user/"
@@ -149,10 +157,9 @@ main(int argc, char *argv[])
 
     inum = ialloc(T_FILE);
 
-    bzero(&de, sizeof(de));
-    de.inum = xshort(inum);
-    strncpy(de.name, shortname, DIRSIZ);
-    iappend(rootino, &de, sizeof(de));
+    assert(nrootents < NINODES);
+    rootents[nrootents].inum = xshort(inum);
+    strncpy(rootents[nrootents++].name, shortname, DIRSIZ);
 
     while((cc = read(fd, buf, sizeof(buf))) > 0)
       iappend(inum, buf, cc);
@@ -160,12 +167,7 @@ main(int argc, char *argv[])
     close(fd);
   }
 
-  // fix size of root inode dir
-  rinode(rootino, &din);
-  off = xint(din.size);
-  off = ((off/BSIZE) + 1) * BSIZE;
-  din.size = xint(off);
-  winode(rootino, &din);
+  dirappend(rootino, rootents, nrootents);
 
   balloc(freeblock);
 
@@ -264,7 +266,9 @@ iappend(uint inum, void *xp, int n)
   // printf("append inum %d at off %d sz %d\n", inum, off, n);
   while(n > 0){
     fbn = off / BSIZE;
-    assert(fbn < MAXFILE);
+    // files in the initial image need no more than
+    // the singly indirect block.
+    assert(fbn < NDIRECT + NINDIRECT);
     if(fbn < NDIRECT){
       if(xint(din.addrs[fbn]) == 0){
         din.addrs[fbn] = xint(freeblock++);
@@ -293,6 +297,39 @@ iappend(uint inum, void *xp, int n)
   winode(inum, &din);
 }
 
+// Write the n entries ents as the contents of empty directory
+// inum, laid out as the kernel's hashed directories expect
+// (see dirbucket() in kernel/fs.h): use the fewest buckets in
+// which no bucket overflows.
+void
+dirappend(uint inum, struct dirent *ents, int n)
+{
+  struct dirent *blocks;
+  int *used;
+  int nb, i, b, ok;
+
+  for(nb = 1; ; nb++){
+    assert(nb <= MAXFILE);
+    blocks = calloc(nb, BSIZE);
+    used = calloc(nb, sizeof(int));
+    ok = 1;
+    for(i = 0; i < n && ok; i++){
+      b = dirbucket(dirhash(ents[i].name), nb);
+      if(used[b] == DPB-1)
+        ok = 0;
+      else
+        blocks[b*DPB + used[b]++] = ents[i];
+    }
+    if(ok)
+      break;
+    free(blocks);
+    free(used);
+  }
+  iappend(inum, blocks, nb*BSIZE);
+  free(blocks);
+  free(used);
+}
+
 void
 die(const char *s)
 {
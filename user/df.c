@@ -0,0 +1,19 @@
+#include "kernel/types.h"
+#include "kernel/statfs.h"
+#include "user/user.h"
+
+// Print how much of the file system is free.
+int
+main(int argc, char *argv[])
+{
+  struct statfs st;
+
+  if(statfs(&st) < 0){
+    fprintf(2, "df: statfs failed\n");
+    exit(1);
+  }
+  printf("blocks %d data %d free %d (%d%%) log %d inodes %d\n",
+         st.size, st.nblocks, st.nfree, st.nfree * 100 / st.nblocks,
+         st.nlog, st.ninodes);
+  exit(0);
+}
@@ -0,0 +1,32 @@
+#include "kernel/types.h"
+#include "kernel/blkstat.h"
+#include "user/user.h"
+
+// Print the block I/O queue statistics.
+int
+main(int argc, char *argv[])
+{
+  struct blkstat st;
+  int i;
+
+  if(blkstat(&st) < 0){
+    fprintf(2, "iostat: blkstat failed\n");
+    exit(1);
+  }
+  printf("blocks %l requests %l merged %l expired %l\n",
+         st.nbuf, st.nreq, st.nmerge, st.nexpired);
+  printf("queues %d queued %d (max %d) in flight %d\n",
+         st.nqueue, st.depth, st.maxdepth, st.inflight);
+  printf("notifications %l interrupts %l\n", st.nkick, st.nintr);
+  printf("polled %l completed while polling %l\n", st.npoll, st.npollwon);
+  printf("latency (us)  requests\n");
+  for(i = 0; i < NBLKHIST; i++){
+    if(st.lat[i] == 0)
+      continue;
+    if(i == NBLKHIST-1)
+      printf("%d+\t%l\n", 1 << i, st.lat[i]);
+    else
+      printf("%d-%d\t%l\n", i == 0 ? 0 : 1 << i, (2 << i) - 1, st.lat[i]);
+  }
+  exit(0);
+}
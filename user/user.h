@@ -1,4 +1,9 @@
 struct stat;
+struct blkstat;
+struct statfs;
+struct pollfd;
+struct epoll_event;
+struct ioring;
 struct rtcdate;
 
 // system calls
@@ -23,6 +28,19 @@ int getpid(void);
 char* sbrk(int);
 int sleep(int);
 int uptime(void);
+int fsync(int);
+int sync(void);
+int blkstat(struct blkstat*);
+int statfs(struct statfs*);
+int fcntl(int, int, int);
+int splice(int, int, int);
+int poll(struct pollfd*, int, int);
+int epoll_create(void);
+int epoll_ctl(int, int, int, struct epoll_event*);
+int epoll_wait(int, struct epoll_event*, int, int);
+int ioring_enter(struct ioring*);
+int clock_gettime(uint64*);
+int nanosleep(uint64);
 
 // ulib.c
 int stat(const char*, struct stat*);
@@ -7,6 +7,10 @@
 #include "kernel/syscall.h"
 #include "kernel/memlayout.h"
 #include "kernel/riscv.h"
+#include "kernel/statfs.h"
+#include "kernel/poll.h"
+#include "kernel/epoll.h"
+#include "kernel/ioring.h"
 
 //
 // Tests xv6 system calls.  usertests without arguments runs them all
@@ -569,6 +573,9 @@ writetest(char *s)
   }
 }
 
+// big enough to need the doubly-indirect block.
+#define BIGFILE (NDIRECT + NINDIRECT + 2*NINDIRECT)
+
 void
 writebig(char *s)
 {
@@ -580,7 +587,7 @@ writebig(char *s)
     exit(1);
   }
 
-  for(i = 0; i < MAXFILE; i++){
+  for(i = 0; i < BIGFILE; i++){
     ((int*)buf)[0] = i;
     if(write(fd, buf, BSIZE) != BSIZE){
       printf("%s: error: write big file failed\n", s, i);
@@ -600,7 +607,7 @@ writebig(char *s)
   for(;;){
     i = read(fd, buf, BSIZE);
     if(i == 0){
-      if(n == MAXFILE - 1){
+      if(n != BIGFILE){
         printf("%s: read only %d blocks from big", s, n);
         exit(1);
       }
@@ -623,6 +630,94 @@ writebig(char *s)
   }
 }
 
+// fsync() and sync() of written files, and of things that aren't.
+void
+fsynctest(char *s)
+{
+  int fd, fds[2];
+
+  fd = open("fsyncf", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf("%s: create fsyncf failed\n", s);
+    exit(1);
+  }
+  if(write(fd, "x", 1) != 1){
+    printf("%s: write fsyncf failed\n", s);
+    exit(1);
+  }
+  if(fsync(fd) != 0){
+    printf("%s: fsync failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  if(fsync(fd) != -1){
+    printf("%s: fsync of closed fd succeeded\n", s);
+    exit(1);
+  }
+  if(pipe(fds) < 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  if(fsync(fds[0]) != -1){
+    printf("%s: fsync of pipe succeeded\n", s);
+    exit(1);
+  }
+  close(fds[0]);
+  close(fds[1]);
+  if(unlink("fsyncf") < 0 || sync() != 0){
+    printf("%s: unlink or sync failed\n", s);
+    exit(1);
+  }
+  if(open("fsyncf", O_RDONLY) >= 0){
+    printf("%s: fsyncf still exists\n", s);
+    exit(1);
+  }
+}
+
+// statfs() counts the blocks a file takes and gives back.
+void
+statfstest(char *s)
+{
+  struct statfs st0, st1, st2;
+  char buf[BSIZE];
+  int fd, i;
+
+  fd = open("statfsf", O_CREATE|O_RDWR);
+  if(fd < 0 || statfs(&st0) < 0){
+    printf("%s: create or statfs failed\n", s);
+    exit(1);
+  }
+  if(st0.nfree == 0 || st0.nfree > st0.nblocks){
+    printf("%s: bad free count %d of %d\n", s, st0.nfree, st0.nblocks);
+    exit(1);
+  }
+  memset(buf, 'a', sizeof(buf));
+  for(i = 0; i < NDIRECT + 10; i++){
+    if(write(fd, buf, sizeof(buf)) != sizeof(buf)){
+      printf("%s: write failed\n", s);
+      exit(1);
+    }
+  }
+  close(fd);
+  statfs(&st1);
+  if(st1.nfree != st0.nfree - (NDIRECT + 10 + 1)){  // + indirect block
+    printf("%s: free %d, then %d\n", s, st0.nfree, st1.nfree);
+    exit(1);
+  }
+  fd = open("statfsf", O_RDWR|O_TRUNC);
+  if(fd < 0){
+    printf("%s: truncate failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  statfs(&st2);
+  if(st2.nfree != st0.nfree){
+    printf("%s: free %d, then %d after truncate\n", s, st0.nfree, st2.nfree);
+    exit(1);
+  }
+  unlink("statfsf");
+}
+
 // many creates, followed by unlink test
 void
 createtest(char *s)
@@ -780,6 +875,536 @@ pipe1(char *s)
 }
 
 
+// fcntl() can grow a pipe's buffer, keeping what is in it.
+void
+pipesize(char *s)
+{
+  int fds[2], i, n, seq;
+
+  if(pipe(fds) != 0){
+    printf("%s: pipe() failed\n", s);
+    exit(1);
+  }
+  if(fcntl(fds[0], F_GETPIPE_SZ, 0) != 4096){
+    printf("%s: pipe size %d\n", s, fcntl(fds[0], F_GETPIPE_SZ, 0));
+    exit(1);
+  }
+  // leave data wrapped around the end of the buffer.
+  for(i = 0; i < 4000; i++)
+    buf[i] = i;
+  if(write(fds[1], buf, 4000) != 4000 || read(fds[0], buf, 3000) != 3000 ||
+     write(fds[1], buf, 2000) != 2000){
+    printf("%s: pipe write/read failed\n", s);
+    exit(1);
+  }
+  if(fcntl(fds[1], F_SETPIPE_SZ, 10000) != 16384 ||
+     fcntl(fds[0], F_GETPIPE_SZ, 0) != 16384){
+    printf("%s: resize failed\n", s);
+    exit(1);
+  }
+  // the 3000 bytes now fill without blocking.
+  if(write(fds[1], buf, 3000) != 3000){
+    printf("%s: write after resize failed\n", s);
+    exit(1);
+  }
+  if(fcntl(fds[0], F_SETPIPE_SZ, 4096) != -1){
+    printf("%s: shrank below contents\n", s);
+    exit(1);
+  }
+  if(fcntl(fds[0], F_SETPIPE_SZ, 1024*1024) != -1){
+    printf("%s: grew too big\n", s);
+    exit(1);
+  }
+  seq = 3000;
+  for(n = 0; n < 1000 + 2000 + 3000; n++){
+    char c;
+    if(read(fds[0], &c, 1) != 1 || c != (char)seq){
+      printf("%s: wrong data at %d\n", s, n);
+      exit(1);
+    }
+    seq = (n == 999 || n == 2999) ? 0 : seq + 1;
+  }
+  close(fds[0]);
+  close(fds[1]);
+  if((fds[0] = open("pipesizef", O_CREATE|O_RDWR)) < 0){
+    printf("%s: create pipesizef failed\n", s);
+    exit(1);
+  }
+  if(fcntl(fds[0], F_GETPIPE_SZ, 0) != -1){
+    printf("%s: fcntl of a file succeeded\n", s);
+    exit(1);
+  }
+  close(fds[0]);
+  unlink("pipesizef");
+}
+
+// splice() moves data from a file into a pipe and from
+// a pipe into a file.
+void
+splicetest(char *s)
+{
+  int fd, fds[2], i, n;
+
+  fd = open("splicef", O_CREATE|O_RDWR);
+  for(i = 0; i < 5000; i++)
+    buf[i] = i % 251;
+  if(fd < 0 || write(fd, buf, 5000) != 5000){
+    printf("%s: create splicef failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  if(pipe(fds) != 0 || fcntl(fds[1], F_SETPIPE_SZ, 8192) != 8192){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  fd = open("splicef", O_RDONLY);
+  if((n = splice(fd, fds[1], 10000)) != 5000){
+    printf("%s: splice from file moved %d\n", s, n);
+    exit(1);
+  }
+  if(splice(fd, fds[1], 10000) != 0){
+    printf("%s: splice past end of file\n", s);
+    exit(1);
+  }
+  if(splice(fd, fd, 10) != -1 || splice(fds[0], fds[1], 10) != -1){
+    printf("%s: splice without exactly one pipe\n", s);
+    exit(1);
+  }
+  close(fd);
+  close(fds[1]);
+
+  fd = open("splicef2", O_CREATE|O_RDWR);
+  if((n = splice(fds[0], fd, 10000)) != 5000){
+    printf("%s: splice to file moved %d\n", s, n);
+    exit(1);
+  }
+  if(splice(fds[0], fd, 10000) != 0){
+    printf("%s: splice from closed pipe\n", s);
+    exit(1);
+  }
+  close(fds[0]);
+  close(fd);
+
+  fd = open("splicef2", O_RDONLY);
+  memset(buf, 0, 5000);
+  if(read(fd, buf, sizeof(buf)) != 5000){
+    printf("%s: splicef2 is the wrong size\n", s);
+    exit(1);
+  }
+  for(i = 0; i < 5000; i++){
+    if(buf[i] != (char)(i % 251)){
+      printf("%s: wrong data at %d\n", s, i);
+      exit(1);
+    }
+  }
+  close(fd);
+  unlink("splicef");
+  unlink("splicef2");
+}
+
+void
+polltest(char *s)
+{
+  int a[2], b[2], pid, xst;
+  struct pollfd pfd[3];
+
+  if(pipe(a) != 0 || pipe(b) != 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  pfd[0].fd = a[0];
+  pfd[0].events = POLLIN;
+  pfd[1].fd = a[1];
+  pfd[1].events = POLLOUT;
+  if(poll(pfd, 1, 0) != 0 || pfd[0].revents != 0){
+    printf("%s: empty pipe is readable\n", s);
+    exit(1);
+  }
+  if(poll(pfd, 2, 0) != 1 || pfd[1].revents != POLLOUT){
+    printf("%s: empty pipe is not writable\n", s);
+    exit(1);
+  }
+  write(a[1], "x", 1);
+  if(poll(pfd, 2, 0) != 2 || pfd[0].revents != POLLIN){
+    printf("%s: pipe with data is not readable\n", s);
+    exit(1);
+  }
+
+  // wait for a child to write to the second pipe.
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    sleep(2);
+    write(b[1], "y", 1);
+    exit(0);
+  }
+  pfd[0].fd = b[0];
+  pfd[0].events = POLLIN;
+  if(poll(pfd, 1, -1) != 1 || pfd[0].revents != POLLIN){
+    printf("%s: poll did not see the child's write\n", s);
+    exit(1);
+  }
+  wait(&xst);
+  read(b[0], buf, 1);
+  if(poll(pfd, 1, 3) != 0){
+    printf("%s: poll did not time out\n", s);
+    exit(1);
+  }
+  close(b[1]);
+  if(poll(pfd, 1, -1) != 1 || pfd[0].revents != POLLHUP){
+    printf("%s: no hangup after the writer closed\n", s);
+    exit(1);
+  }
+
+  pfd[0].fd = -1;
+  if(poll(pfd, 1, 0) != 0 || pfd[0].revents != 0){
+    printf("%s: negative fd not ignored\n", s);
+    exit(1);
+  }
+
+  pfd[0].fd = 100;
+  pfd[1].fd = b[1];
+  if(poll(pfd, 2, 0) != 2 || pfd[0].revents != POLLNVAL || pfd[1].revents != POLLNVAL){
+    printf("%s: bad fds not reported\n", s);
+    exit(1);
+  }
+  close(a[0]);
+  close(a[1]);
+  close(b[0]);
+}
+
+// a writer blocked on a full pipe must wake a reader
+// waiting in poll() or epoll_wait().
+void
+pollfull(char *s)
+{
+  int fds[2], ep, pid, xst, n, tot, size, round;
+  struct pollfd pfd;
+  struct epoll_event ev;
+
+  for(round = 0; round < 2; round++){
+    if(pipe(fds) != 0 || (size = fcntl(fds[0], F_GETPIPE_SZ, 0)) <= 0){
+      printf("%s: pipe failed\n", s);
+      exit(1);
+    }
+    ep = -1;
+    if(round == 1){
+      ev.events = POLLIN;
+      ev.data = 0;
+      if((ep = epoll_create()) < 0 || epoll_ctl(ep, EPOLL_CTL_ADD, fds[0], &ev) != 0){
+        printf("%s: epoll failed\n", s);
+        exit(1);
+      }
+    }
+    pid = fork();
+    if(pid < 0){
+      printf("%s: fork failed\n", s);
+      exit(1);
+    }
+    if(pid == 0){
+      close(fds[0]);
+      memset(buf, 'x', size + 1000);
+      if(write(fds[1], buf, size + 1000) != size + 1000)
+        exit(1);
+      exit(0);
+    }
+    close(fds[1]);
+    tot = 0;
+    for(;;){
+      if(round == 0){
+        pfd.fd = fds[0];
+        pfd.events = POLLIN;
+        n = poll(&pfd, 1, -1);
+      } else {
+        n = epoll_wait(ep, &ev, 1, -1);
+      }
+      if(n != 1){
+        printf("%s: wait returned %d\n", s, n);
+        exit(1);
+      }
+      if((n = read(fds[0], buf, sizeof(buf))) <= 0)
+        break;
+      tot += n;
+    }
+    wait(&xst);
+    if(xst != 0 || tot != size + 1000){
+      printf("%s: read %d of %d\n", s, tot, size + 1000);
+      exit(1);
+    }
+    close(fds[0]);
+    if(ep >= 0)
+      close(ep);
+  }
+}
+
+void
+epolltest(char *s)
+{
+  int ep, a[2], b[2], pid, xst;
+  struct epoll_event ev, evs[4];
+
+  if((ep = epoll_create()) < 0 || pipe(a) != 0 || pipe(b) != 0){
+    printf("%s: epoll_create or pipe failed\n", s);
+    exit(1);
+  }
+  ev.events = POLLIN;
+  ev.data = 1;
+  if(epoll_ctl(ep, EPOLL_CTL_ADD, a[0], &ev) != 0){
+    printf("%s: add failed\n", s);
+    exit(1);
+  }
+  ev.events = POLLIN | EPOLLET;
+  ev.data = 2;
+  if(epoll_ctl(ep, EPOLL_CTL_ADD, b[0], &ev) != 0){
+    printf("%s: add failed\n", s);
+    exit(1);
+  }
+  if(epoll_ctl(ep, EPOLL_CTL_ADD, b[0], &ev) != -1 ||
+     epoll_ctl(ep, EPOLL_CTL_ADD, ep, &ev) != -1){
+    printf("%s: bad add succeeded\n", s);
+    exit(1);
+  }
+  if(epoll_wait(ep, evs, 4, 0) != 0){
+    printf("%s: idle pipes reported\n", s);
+    exit(1);
+  }
+
+  // level-triggered: reported until the data is read.
+  write(a[1], "x", 1);
+  write(b[1], "y", 1);
+  if(epoll_wait(ep, evs, 4, 0) != 2){
+    printf("%s: ready pipes not reported\n", s);
+    exit(1);
+  }
+  if(epoll_wait(ep, evs, 4, 0) != 1 || evs[0].data != 1 || evs[0].events != POLLIN){
+    printf("%s: wrong level-triggered event\n", s);
+    exit(1);
+  }
+  read(a[0], buf, 1);
+  if(epoll_wait(ep, evs, 4, 0) != 0){
+    printf("%s: drained pipe reported\n", s);
+    exit(1);
+  }
+
+  // edge-triggered: reported again after another write.
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    sleep(2);
+    write(b[1], "z", 1);
+    exit(0);
+  }
+  if(epoll_wait(ep, evs, 4, -1) != 1 || evs[0].data != 2){
+    printf("%s: wrong edge-triggered event\n", s);
+    exit(1);
+  }
+  wait(&xst);
+  if(epoll_wait(ep, evs, 4, 3) != 0){
+    printf("%s: epoll_wait did not time out\n", s);
+    exit(1);
+  }
+
+  // closing a watched file drops the watch, so the
+  // reader still sees the hangup.
+  ev.events = POLLOUT;
+  ev.data = 3;
+  if(epoll_ctl(ep, EPOLL_CTL_ADD, a[1], &ev) != 0){
+    printf("%s: add failed\n", s);
+    exit(1);
+  }
+  close(a[1]);
+  if(epoll_wait(ep, evs, 4, 0) != 1 || evs[0].data != 1 || evs[0].events != POLLHUP){
+    printf("%s: no hangup after the writer closed\n", s);
+    exit(1);
+  }
+  if(epoll_ctl(ep, EPOLL_CTL_DEL, a[0], 0) != 0 ||
+     epoll_ctl(ep, EPOLL_CTL_DEL, a[0], 0) != -1){
+    printf("%s: del failed\n", s);
+    exit(1);
+  }
+  close(ep);
+  close(a[0]);
+  close(b[0]);
+  close(b[1]);
+}
+
+static struct ioring ring;
+
+// queue system call op in ring.
+static void
+iosubmit(int op, uint64 a0, uint64 a1, uint64 a2, uint64 data)
+{
+  struct io_sqe *e = &ring.sq[ring.sqtail % IORING_SIZE];
+
+  e->op = op;
+  e->arg[0] = a0;
+  e->arg[1] = a1;
+  e->arg[2] = a2;
+  e->data = data;
+  ring.sqtail++;
+}
+
+void
+ioringtest(char *s)
+{
+  int fd, i, n;
+  struct stat st;
+  struct io_cqe *c;
+
+  iosubmit(SYS_open, (uint64)"ioringf", O_CREATE|O_RDWR, 0, 100);
+  if(ioring_enter(&ring) != 1 || ring.cqtail != 1 || ring.cq[0].data != 100){
+    printf("%s: open not run\n", s);
+    exit(1);
+  }
+  if((fd = ring.cq[0].res) < 0){
+    printf("%s: open failed\n", s);
+    exit(1);
+  }
+  ring.cqhead++;
+
+  // one trap for ten writes, an fstat and a close.
+  for(i = 0; i < 10; i++){
+    buf[i] = 'a' + i;
+    iosubmit(SYS_write, fd, (uint64)&buf[i], 1, i);
+  }
+  iosubmit(SYS_fstat, fd, (uint64)&st, 0, 10);
+  iosubmit(SYS_close, fd, 0, 0, 11);
+  iosubmit(SYS_fork, 0, 0, 0, 12);
+  if((n = ioring_enter(&ring)) != 13 || ring.sqhead != ring.sqtail){
+    printf("%s: ran %d of 13\n", s, n);
+    exit(1);
+  }
+  for(i = 0; i < 13; i++){
+    c = &ring.cq[ring.cqhead++ % IORING_SIZE];
+    if(c->data != i || c->res != (i < 10 ? 1 : i < 12 ? 0 : -1)){
+      printf("%s: completion %d has result %d\n", s, i, c->res);
+      exit(1);
+    }
+  }
+  if(st.size != 10){
+    printf("%s: fstat size %d\n", s, (int)st.size);
+    exit(1);
+  }
+
+  // stop when the completion ring is full.
+  ring.cqhead = ring.cqtail - IORING_SIZE + 1;
+  iosubmit(SYS_close, 100, 0, 0, 0);
+  iosubmit(SYS_close, 100, 0, 0, 0);
+  if(ioring_enter(&ring) != 1 || ring.sqhead + 1 != ring.sqtail){
+    printf("%s: overran the completion ring\n", s);
+    exit(1);
+  }
+  ring.cqhead = ring.cqtail;
+  if(ioring_enter(&ring) != 1 || ring.sqhead != ring.sqtail){
+    printf("%s: did not finish the batch\n", s);
+    exit(1);
+  }
+  unlink("ioringf");
+}
+
+// getpid() and uptime() read pages mapped by the kernel.
+void
+usyscall(char *s)
+{
+  int pid, xst, t0, i;
+
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0)
+    exit(getpid() % 128);
+  wait(&xst);
+  if(xst != pid % 128){
+    printf("%s: child saw pid %d, not %d\n", s, xst, pid % 128);
+    exit(1);
+  }
+
+  t0 = uptime();
+  sleep(2);
+  if(uptime() - t0 < 2){
+    printf("%s: uptime did not advance\n", s);
+    exit(1);
+  }
+
+  if(((struct ushared*)USHARED)->timefreq == 0){
+    printf("%s: no time CSR frequency\n", s);
+    exit(1);
+  }
+
+  // the pages are read-only.
+  for(i = 0; i < 2; i++){
+    pid = fork();
+    if(pid < 0){
+      printf("%s: fork failed\n", s);
+      exit(1);
+    }
+    if(pid == 0){
+      if(i == 0)
+        *(int*)USYSCALL = 0;
+      else
+        *(uint*)USHARED = 0;
+      exit(0);
+    }
+    wait(&xst);
+    if(xst != -1){
+      printf("%s: wrote the read-only %s page\n", s, i == 0 ? "pid" : "shared");
+      exit(1);
+    }
+  }
+}
+
+// clock_gettime() has nanosecond resolution, and
+// nanosleep() ends well before the next clock tick.
+void
+nanosleeptest(char *s)
+{
+  uint64 t0, t1;
+  int i, start, pid, xst;
+
+  if(clock_gettime(&t0) != 0 || nanosleep(20*1000*1000) != 0 || clock_gettime(&t1) != 0){
+    printf("%s: clock_gettime or nanosleep failed\n", s);
+    exit(1);
+  }
+  if(t1 - t0 < 20*1000*1000){
+    printf("%s: slept %d ns, not 20 ms\n", s, (int)(t1 - t0));
+    exit(1);
+  }
+
+  start = uptime();
+  for(i = 0; i < 10; i++)
+    nanosleep(1000*1000);
+  if(uptime() - start >= 5){
+    printf("%s: 10 1ms sleeps took %d ticks\n", s, uptime() - start);
+    exit(1);
+  }
+
+  // kill() ends a long sleep.
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    nanosleep(1000L*1000*1000*1000);
+    exit(0);
+  }
+  sleep(1);
+  kill(pid);
+  wait(&xst);
+  if(xst != -1){
+    printf("%s: killed sleeper exited with %d\n", s, xst);
+    exit(1);
+  }
+}
+
 // test if child is killed (status = -1)
 void
 killstatus(char *s)
@@ -2865,12 +3490,22 @@ main(int argc, char *argv[])
     {opentest, "opentest"},
     {writetest, "writetest"},
     {writebig, "writebig"},
+    {fsynctest, "fsynctest"},
+    {statfstest, "statfstest"},
     {createtest, "createtest"},
     {openiputtest, "openiput"},
     {exitiputtest, "exitiput"},
     {iputtest, "iput"},
     {mem, "mem"},
     {pipe1, "pipe1"},
+    {pipesize, "pipesize"},
+    {splicetest, "splicetest"},
+    {polltest, "polltest"},
+    {pollfull, "pollfull"},
+    {epolltest, "epolltest"},
+    {ioringtest, "ioringtest"},
+    {usyscall, "usyscall"},
+    {nanosleeptest, "nanosleeptest"},
     {killstatus, "killstatus"},
     {preempt, "preempt"},
     {exitwait, "exitwait"},
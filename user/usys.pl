@@ -32,7 +32,18 @@ entry("link");
 entry("mkdir");
 entry("chdir");
 entry("dup");
-entry("getpid");
 entry("sbrk");
 entry("sleep");
-entry("uptime");
+entry("fsync");
+entry("sync");
+entry("blkstat");
+entry("statfs");
+entry("fcntl");
+entry("splice");
+entry("poll");
+entry("epoll_create");
+entry("epoll_ctl");
+entry("epoll_wait");
+entry("ioring_enter");
+entry("clock_gettime");
+entry("nanosleep");